@@ -1,6 +1,37 @@
 #include "include/api.h"
 
+#include <algorithm>
+
+#include "include/geometry.h"
+#include "include/model.h"
+#include "include/program.h"
+
+// Runs on the Python side, so that each of these is a single call from C++. Paths come in as the raw bytes of their
+// points, which is cheaper than converting every coordinate to a Python float on the C++ side.
+static constexpr const char *HELPERS = R"(
+from array import array
+
+def read_state(axidraw):
+    position = axidraw.current_pos
+    if callable(position):
+        position = position()
+
+    return bool(axidraw.current_pen()), float(position[0]), float(position[1])
+
+def draw_path(axidraw, data):
+    points = array("d")
+    points.frombytes(data)
+
+    axidraw.moveto(points[0], points[1])
+    lineto = axidraw.lineto
+    for i in range(2, len(points), 2):
+        lineto(points[i], points[i + 1])
+)";
+
+static_assert(sizeof(Point) == 2 * sizeof(double), "draw_path() expects points as packed pairs of doubles.");
+
 AxiDraw::AxiDraw()
+        : isPenUp(true), position({0, 0}), crossings(0), created(std::chrono::steady_clock::now()), pythonTime()
 {
     Py_Initialize();
     std::string version = boost::python::extract<std::string>(boost::python::import("platform").attr(
@@ -18,6 +49,13 @@ AxiDraw::AxiDraw()
     try
     {
         axiDraw = boost::python::import("pyaxidraw.axidraw").attr("AxiDraw")();
+        options = axiDraw.attr("options");
+
+        boost::python::dict helpers;
+        boost::python::exec(HELPERS, helpers);
+
+        methods = {axiDraw.attr("moveto"), axiDraw.attr("move"), axiDraw.attr("delay"), axiDraw.attr("penup"),
+                   axiDraw.attr("pendown"), helpers["draw_path"], helpers["read_state"]};
         Log(Log::Type::DEBUG, "AxiDraw API initialized.");
     }
     catch (boost::python::error_already_set &e)
@@ -27,77 +65,117 @@ AxiDraw::AxiDraw()
     }
 }
 
+AxiDraw::~AxiDraw()
+{
+    if (!stats) return;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - created).count();
+    Log(Log::Type::INFO, "Made " + std::to_string(crossings) + " calls into Python in " + std::to_string(seconds) +
+                         " s (" + std::to_string(static_cast<double>(crossings) / std::max(seconds, 1e-9)) +
+                         " calls/s), " + std::to_string(std::chrono::duration<double>(pythonTime).count()) +
+                         " s of it inside Python.");
+}
+
+template<typename... Arguments>
+boost::python::object AxiDraw::call(const boost::python::object &function, const Arguments &...arguments)
+{
+    auto start = std::chrono::steady_clock::now();
+    boost::python::object result = function(arguments...);
+
+    pythonTime += std::chrono::steady_clock::now() - start;
+    crossings++;
+    return result;
+}
+
+void AxiDraw::setOption(const char *name, const boost::python::object &value)
+{
+    auto start = std::chrono::steady_clock::now();
+    options.attr(name) = value;
+
+    pythonTime += std::chrono::steady_clock::now() - start;
+    crossings++;
+}
+
+void AxiDraw::moveTo(const Point &target)
+{
+    const ModelSpec &model = MODEL_SPECS[active.model];
+    double unitsPerInch = UNITS_PER_INCH[active.units];
+
+    position = Rect{0, 0, model.width, model.height}.clamp({target.x / unitsPerInch, target.y / unitsPerInch});
+}
+
 #pragma region General
 
 void AxiDraw::setAcceleration(double acceleration)
 {
-    axiDraw.attr("options").attr("accel") = acceleration;
+    setOption("accel", boost::python::object(acceleration));
     Log(Log::Type::DEBUG, "Set accel to " + std::to_string(acceleration) + ".");
 }
 
 void AxiDraw::setPenUpPosition(double position)
 {
-    axiDraw.attr("options").attr("pen_pos_up") = position;
+    setOption("pen_pos_up", boost::python::object(position));
     Log(Log::Type::DEBUG, "Set pen_pos_up to " + std::to_string(position) + ".");
 }
 
 void AxiDraw::setPenDownPosition(double position)
 {
-    axiDraw.attr("options").attr("pen_pos_down") = position;
+    setOption("pen_pos_down", boost::python::object(position));
     Log(Log::Type::DEBUG, "Set pen_pos_down to " + std::to_string(position) + ".");
 }
 
 void AxiDraw::setPenUpDelay(double delay)
 {
-    axiDraw.attr("options").attr("pen_delay_up") = delay;
+    setOption("pen_delay_up", boost::python::object(delay));
     Log(Log::Type::DEBUG, "Set pen_delay_up to " + std::to_string(delay) + ".");
 }
 
 void AxiDraw::setPenDownDelay(double delay)
 {
-    axiDraw.attr("options").attr("pen_delay_down") = delay;
+    setOption("pen_delay_down", boost::python::object(delay));
     Log(Log::Type::DEBUG, "Set pen_delay_down to " + std::to_string(delay) + ".");
 }
 
 void AxiDraw::setPenUpSpeed(double speed)
 {
-    axiDraw.attr("options").attr("speed_penup") = speed;
+    setOption("speed_penup", boost::python::object(speed));
     Log(Log::Type::DEBUG, "Set speed_penup to " + std::to_string(speed) + ".");
 }
 
 void AxiDraw::setPenDownSpeed(double speed)
 {
-    axiDraw.attr("options").attr("speed_pendown") = speed;
+    setOption("speed_pendown", boost::python::object(speed));
     Log(Log::Type::DEBUG, "Set speed_pendown to " + std::to_string(speed) + ".");
 }
 
 void AxiDraw::setPenUpRate(double rate)
 {
-    axiDraw.attr("options").attr("pen_rate_raise") = rate;
+    setOption("pen_rate_raise", boost::python::object(rate));
     Log(Log::Type::DEBUG, "Set pen_rate_raise to " + std::to_string(rate) + ".");
 }
 
 void AxiDraw::setPenDownRate(double rate)
 {
-    axiDraw.attr("options").attr("pen_rate_lower") = rate;
+    setOption("pen_rate_lower", boost::python::object(rate));
     Log(Log::Type::DEBUG, "Set pen_rate_lower to " + std::to_string(rate) + ".");
 }
 
 void AxiDraw::setModel(int model)
 {
-    axiDraw.attr("options").attr("model") = model;
+    pending.model = std::clamp(model, 1, static_cast<int>(MODEL_COUNT) - 1);
+    setOption("model", boost::python::object(model));
     Log(Log::Type::DEBUG, "Set model to " + std::to_string(model) + ".");
 }
 
 void AxiDraw::setPort(const std::string &port)
 {
-    axiDraw.attr("options").attr("port") = port != "auto" ? boost::python::str(port) : boost::python::object();
+    setOption("port", port != "auto" ? boost::python::str(port) : boost::python::object());
     Log(Log::Type::DEBUG, "Set port to " + port + ".");
 }
 
 std::string AxiDraw::getMode()
 {
-    std::string mode = boost::python::extract<std::string>(axiDraw.attr("options").attr("mode"));
+    std::string mode = boost::python::extract<std::string>(options.attr("mode"));
     Log(Log::Type::DEBUG, "  Mode is " + mode + ".");
 
     return mode;
@@ -108,117 +186,137 @@ std::string AxiDraw::getMode()
 
 void AxiDraw::modeInteractive()
 {
-    axiDraw.attr("interactive")();
+    call(axiDraw.attr("interactive"));
     Log(Log::Type::DEBUG, "Mode is set to interactive.");
 }
 
 void AxiDraw::setUnits(int units)
 {
-    axiDraw.attr("options").attr("units") = units;
+    pending.units = std::clamp(units, 0, 2);
+    setOption("units", boost::python::object(units));
     Log(Log::Type::DEBUG, "Set units to " + std::to_string(units) + ".");
 }
 
 void AxiDraw::connect()
 {
-    if (!axiDraw.attr("connect")()) Log(Log::Type::FATAL, "Could not connect to AxiDraw.");
-    else Log(Log::Type::DEBUG, "Connected to AxiDraw.");
+    if (!call(axiDraw.attr("connect"))) Log(Log::Type::FATAL, "Could not connect to AxiDraw.");
+
+    active = pending;
+    sync();
+    Log(Log::Type::DEBUG, "Connected to AxiDraw.");
 }
 
 void AxiDraw::disconnect()
 {
-    axiDraw.attr("disconnect")();
+    call(axiDraw.attr("disconnect"));
     Log(Log::Type::DEBUG, "Disconnected from AxiDraw.");
 }
 
 void AxiDraw::updateOptions()
 {
-    axiDraw.attr("update")();
+    call(axiDraw.attr("update"));
+    active = pending;
     Log(Log::Type::DEBUG, "Updated options.");
 }
 
 void AxiDraw::penUp()
 {
-    if (!axiDraw.attr("current_pen")())
-    {
-        axiDraw.attr("penup")();
-        Log(Log::Type::DEBUG, "Pen is up.");
-    }
+    if (isPenUp) return;
+
+    call(methods.penUp);
+    isPenUp = true;
+    Log(Log::Type::DEBUG, "Pen is up.");
 }
 
 void AxiDraw::penDown()
 {
-    if (axiDraw.attr("current_pen")())
-    {
-        axiDraw.attr("pendown")();
-        Log(Log::Type::DEBUG, "Pen is down.");
-    }
+    if (!isPenUp) return;
+
+    call(methods.penDown);
+    isPenUp = false;
+    Log(Log::Type::DEBUG, "Pen is down.");
 }
 
 void AxiDraw::penToggle()
 {
-    axiDraw.attr("current_pen")() ? penDown() : penUp();
-    Log(Log::Type::DEBUG, std::string("Pen toggled to ") + (axiDraw.attr("current_pen")() ? "down" : "up") + ".");
+    isPenUp ? penDown() : penUp();
+    Log(Log::Type::DEBUG, std::string("Pen toggled to ") + (isPenUp ? "up" : "down") + ".");
 }
 
 void AxiDraw::home()
 {
-    axiDraw.attr("moveto")(0, 0);
+    call(methods.moveTo, 0, 0);
+    moveTo({0, 0});
+    isPenUp = true;
     Log(Log::Type::DEBUG, "Moved to home.");
 }
 
 void AxiDraw::goTo(double x, double y)
 {
-    axiDraw.attr("moveto")(x, y);
+    call(methods.moveTo, x, y);
+    moveTo({x, y});
+    isPenUp = true;
     Log(Log::Type::DEBUG, "Moved to (" + std::to_string(x) + ", " + std::to_string(y) + ").");
 }
 
 void AxiDraw::goToRelative(double x, double y)
 {
-    axiDraw.attr("move")(x, y);
+    call(methods.move, x, y);
+    double unitsPerInch = UNITS_PER_INCH[active.units];
+    moveTo({position.x * unitsPerInch + x, position.y * unitsPerInch + y});
+    isPenUp = true;
     Log(Log::Type::DEBUG, "Moved to (" + std::to_string(x) + ", " + std::to_string(y) + ") relatively.");
 }
 
-void AxiDraw::draw(std::vector<std::pair<double, double>> path)
+void AxiDraw::draw(const Point *path, size_t count)
 {
-    for (auto point: path)
-    {
-        if (point == path.front())
-        {
-            axiDraw.attr("moveto")(point.first, point.second);
-            Log(Log::Type::DEBUG,
-                "Moved to (" + std::to_string(point.first) + ", " + std::to_string(point.second) + ").");
-        } else
-        {
-            axiDraw.attr("lineto")(point.first, point.second);
-            Log(Log::Type::DEBUG,
-                "Drew line to (" + std::to_string(point.first) + ", " + std::to_string(point.second) + ").");
-        }
-    }
+    if (count == 0) return;
+
+    // The points are only read during the call, so Python can look at them in place.
+    boost::python::object points(boost::python::handle<>(PyMemoryView_FromMemory(
+            reinterpret_cast<char *>(const_cast<Point *>(path)), static_cast<Py_ssize_t>(count * sizeof(Point)),
+            PyBUF_READ)));
+    call(methods.drawPath, axiDraw, points);
+
+    // moveto() to the first point lifts the pen and lineto() to the others lowers it.
+    moveTo(path[count - 1]);
+    isPenUp = count == 1;
+
+    Log(Log::Type::DEBUG, "Drew a path of " + std::to_string(count) + " points to (" +
+                          std::to_string(path[count - 1].x) + ", " + std::to_string(path[count - 1].y) + ").");
 }
 
 void AxiDraw::wait(double ms)
 {
-    axiDraw.attr("delay")(ms);
+    call(methods.delay, ms);
     Log(Log::Type::DEBUG, "Waited for " + std::to_string(ms) + " ms.");
 }
 
 std::pair<double, double> AxiDraw::getPosition()
 {
-    const boost::python::object &pos = axiDraw.attr("current_pos");
-    std::pair<double, double> position = {boost::python::extract<double>(pos[0])(),
-                                          boost::python::extract<double>(pos[1])()};
-
-    Log(Log::Type::DEBUG,
-        "Current position is (" + std::to_string(position.first) + ", " + std::to_string(position.second) + ").");
-    return position;
+    double unitsPerInch = UNITS_PER_INCH[active.units], x = position.x * unitsPerInch, y = position.y * unitsPerInch;
+    Log(Log::Type::DEBUG, "Current position is (" + std::to_string(x) + ", " + std::to_string(y) + ").");
+    return {x, y};
 }
 
 bool AxiDraw::getPen()
 {
-    bool pen = boost::python::extract<bool>(axiDraw.attr("current_pen")());
+    // True while the pen is down, which is how the executor reports it.
+    Log(Log::Type::DEBUG, std::string("Pen status is ") + (isPenUp ? "up" : "down") + ".");
+    return !isPenUp;
+}
 
-    Log(Log::Type::INFO, std::string("Pen status is ") + (pen ? "down" : "up") + ".");
-    return pen;
+void AxiDraw::sync()
+{
+    boost::python::object state = call(methods.readState, axiDraw);
+
+    // current_pen() is true while the pen is up.
+    isPenUp = boost::python::extract<bool>(state[0]);
+    double x = boost::python::extract<double>(state[1]), y = boost::python::extract<double>(state[2]);
+    double unitsPerInch = UNITS_PER_INCH[active.units];
+    position = {x / unitsPerInch, y / unitsPerInch};
+    Log(Log::Type::DEBUG, "Synced with AxiDraw: pen " + std::string(isPenUp ? "up" : "down") + " at (" +
+                          std::to_string(x) + ", " + std::to_string(y) + ").");
 }
 
 #pragma endregion
@@ -230,7 +328,7 @@ void AxiDraw::modePlot(const std::string &filename)
     std::streambuf *outputBuffer = std::cout.rdbuf();
     std::cout.rdbuf(output.rdbuf());
 
-    if (!axiDraw.attr("plot_setup")(filename)) Log(Log::Type::FATAL, "Could not connect to AxiDraw.");
+    if (!call(axiDraw.attr("plot_setup"), filename)) Log(Log::Type::FATAL, "Could not connect to AxiDraw.");
     else Log(Log::Type::DEBUG, "Mode is set to plot.");
 
     std::cout.rdbuf(outputBuffer);
@@ -241,7 +339,7 @@ void AxiDraw::modePlot(const std::string &filename)
 
 void AxiDraw::runPlot()
 {
-    if (!axiDraw.attr("plot_run")()) Log(Log::Type::FATAL, "Could not run plot.");
+    if (!call(axiDraw.attr("plot_run"))) Log(Log::Type::FATAL, "Could not run plot.");
     else Log(Log::Type::DEBUG, "Running plot.");
 }
 
@@ -0,0 +1,217 @@
+#include "include/compiled.h"
+
+// The sections are copied to disk as they are in memory, so their layout is part of the format.
+static_assert(sizeof(CompiledHeader) == 64, "CompiledHeader layout changed, bump CompiledProgram::VERSION.");
+static_assert(sizeof(Instruction) == 32, "Instruction layout changed, bump CompiledProgram::VERSION.");
+static_assert(sizeof(Option) == 24, "Option layout changed, bump CompiledProgram::VERSION.");
+static_assert(sizeof(Point) == 16, "Point layout changed, bump CompiledProgram::VERSION.");
+
+static size_t padded(size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+static bool isValid(const ProgramView &program)
+{
+    for (size_t i = 0; i < program.optionCount; i++)
+    {
+        const Option &option = program.options[i];
+
+        if (option.name < Token::Type::Acceleration || option.name > Token::Type::Units) return false;
+        if (static_cast<uint64_t>(option.first) + option.count > program.strings.size()) return false;
+    }
+
+    for (size_t i = 0; i < program.instructionCount; i++)
+    {
+        const Instruction &instruction = program.instructions[i];
+        size_t limit;
+
+        switch (instruction.op)
+        {
+            case Instruction::Op::Options:
+            case Instruction::Op::UpdateOptions:
+                limit = program.optionCount;
+                break;
+            case Instruction::Op::Draw:
+                limit = program.pointCount;
+                break;
+            case Instruction::Op::SetPlot:
+                limit = program.strings.size();
+                break;
+            default:
+                if (static_cast<uint8_t>(instruction.op) > static_cast<uint8_t>(Instruction::Op::Plot)) return false;
+                continue;
+        }
+
+        if (static_cast<uint64_t>(instruction.first) + instruction.count > limit) return false;
+    }
+
+    return true;
+}
+
+bool CompiledProgram::isCompiled(const std::string &path)
+{
+    char magic[sizeof(MAGIC)] = {};
+    std::ifstream file(path, std::ios::binary);
+
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+std::string CompiledProgram::defaultPath(const std::string &sourcePath)
+{
+    return boost::filesystem::path(sourcePath).replace_extension(".axc").string();
+}
+
+void CompiledProgram::write(const std::string &path, const ProgramView &program, uint64_t sourceHash,
+                            uint64_t sourceSize)
+{
+    // Padding inside Instruction and Option is zeroed so that compiling the same script always gives the same file.
+    std::vector<Instruction> instructions(program.instructionCount);
+    for (size_t i = 0; i < program.instructionCount; i++)
+    {
+        const Instruction &from = program.instructions[i];
+        Instruction &to = instructions[i];
+
+        std::memset(&to, 0, sizeof(to));
+        to.op = from.op;
+        to.line = from.line;
+        to.first = from.first;
+        to.count = from.count;
+        to.x = from.x;
+        to.y = from.y;
+    }
+
+    std::vector<Option> options(program.optionCount);
+    for (size_t i = 0; i < program.optionCount; i++)
+    {
+        std::memset(&options[i], 0, sizeof(Option));
+        options[i].name = program.options[i].name;
+        options[i].value = program.options[i].value;
+        options[i].first = program.options[i].first;
+        options[i].count = program.options[i].count;
+    }
+
+    std::string strings(program.strings);
+    strings.resize(padded(strings.size()), '\0');
+
+    const char *pointData = reinterpret_cast<const char *>(program.points);
+    size_t pointSize = program.pointCount * sizeof(Point);
+
+    CompiledHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.sourceHash = sourceHash;
+    header.sourceSize = sourceSize;
+    header.instructionCount = program.instructionCount;
+    header.pointCount = program.pointCount;
+    header.optionCount = program.optionCount;
+    header.stringSize = program.strings.size();
+
+    header.checksum = hashBytes(reinterpret_cast<const char *>(instructions.data()),
+                                instructions.size() * sizeof(Instruction));
+    header.checksum = hashBytes(pointData, pointSize, header.checksum);
+    header.checksum = hashBytes(reinterpret_cast<const char *>(options.data()), options.size() * sizeof(Option),
+                                header.checksum);
+    header.checksum = hashBytes(strings.data(), strings.size(), header.checksum);
+
+    // Written next to the target and renamed over it, so an interrupted compile never leaves a truncated file behind.
+    boost::filesystem::path temp = path + "." + boost::filesystem::unique_path().string() + ".tmp";
+    std::ofstream file(temp.string(), std::ios::binary | std::ios::trunc);
+    if (!file) Log(Log::Type::FATAL, "Could not create \"" + temp.string() + "\".");
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(instructions.data()),
+               static_cast<std::streamsize>(instructions.size() * sizeof(Instruction)));
+    file.write(pointData, static_cast<std::streamsize>(pointSize));
+    file.write(reinterpret_cast<const char *>(options.data()),
+               static_cast<std::streamsize>(options.size() * sizeof(Option)));
+    file.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+    file.close();
+
+    boost::system::error_code error;
+    if (!file) error = boost::system::errc::make_error_code(boost::system::errc::io_error);
+    else boost::filesystem::rename(temp, path, error);
+
+    if (error)
+    {
+        boost::filesystem::remove(temp, error);
+        Log(Log::Type::FATAL, "Could not write compiled program to \"" + path + "\".");
+    }
+}
+
+bool CompiledProgram::open(const std::string &path, std::string &error)
+{
+    try
+    {
+        mapping.open(path);
+    }
+    catch (const std::exception &)
+    {
+        error = "could not be opened";
+        return false;
+    }
+
+    if (mapping.size() < sizeof(CompiledHeader) || std::memcmp(mapping.data(), MAGIC, sizeof(MAGIC)) != 0)
+    {
+        error = "is not a compiled AxiLang program";
+        return false;
+    }
+
+    header = reinterpret_cast<const CompiledHeader *>(mapping.data());
+    if (header->version != VERSION)
+    {
+        error = "was compiled by a different version of AxiLang (format " + std::to_string(header->version) +
+                ", expected " + std::to_string(VERSION) + ")";
+        return false;
+    }
+
+    // Sizes are checked one by one against what is left, so that huge counts in a damaged header cannot overflow.
+    const char *data = mapping.data() + sizeof(CompiledHeader);
+    size_t remaining = mapping.size() - sizeof(CompiledHeader);
+    const uint64_t sectionSizes[] = {sizeof(Instruction), sizeof(Point), sizeof(Option), 1};
+    const uint64_t counts[] = {header->instructionCount, header->pointCount, header->optionCount, header->stringSize};
+    const char *sections[4];
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        if (counts[i] > remaining / sectionSizes[i] || padded(counts[i] * sectionSizes[i]) > remaining)
+        {
+            error = "is truncated";
+            return false;
+        }
+
+        sections[i] = data;
+        data += padded(counts[i] * sectionSizes[i]);
+        remaining -= padded(counts[i] * sectionSizes[i]);
+    }
+
+    if (remaining != 0 || hashBytes(mapping.data() + sizeof(CompiledHeader),
+                                    mapping.size() - sizeof(CompiledHeader)) != header->checksum)
+    {
+        error = "is corrupted (checksum mismatch)";
+        return false;
+    }
+
+    program = {reinterpret_cast<const Instruction *>(sections[0]), header->instructionCount,
+               reinterpret_cast<const Point *>(sections[1]), header->pointCount,
+               reinterpret_cast<const Option *>(sections[2]), header->optionCount,
+               std::string_view(sections[3], header->stringSize)};
+
+    if (!isValid(program))
+    {
+        error = "contains invalid instructions";
+        return false;
+    }
+
+    return true;
+}
+
+bool CompiledProgram::matches(uint64_t sourceHash, uint64_t sourceSize) const
+{
+    return header && header->sourceHash == sourceHash && header->sourceSize == sourceSize;
+}
+
+ProgramView CompiledProgram::view() const
+{
+    return program;
+}
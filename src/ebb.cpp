@@ -0,0 +1,616 @@
+#include "include/ebb.h"
+
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <vector>
+
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/filesystem.hpp>
+
+// Servo pulse widths at 0% and 100% of the pen range, in units of 83.3 ns.
+static constexpr double SERVO_MIN = 9855;
+static constexpr double SERVO_MAX = 27831;
+// The EBB updates servo positions every 24 ms; SC,11 and SC,12 give the change per update.
+static constexpr double SERVO_UPDATE_MS = 24;
+
+static constexpr int RESPONSE_TIMEOUT_MS = 1000;
+
+// Commands in flight at first and at most. The more there are, the longer a query waits behind them.
+static constexpr size_t INITIAL_WINDOW = 4;
+static constexpr size_t MAX_WINDOW = 32;
+// How often the board's motion queue is polled while moves are being streamed.
+static constexpr int QUEUE_POLL_MS = 250;
+// Commands queued for the writer at most, which is several paths' worth of moves.
+static constexpr size_t MAX_QUEUED = 1024;
+
+#pragma region Connection
+
+EbbConnection::EbbConnection()
+        : port(io), isReading(false), window(INITIAL_WINDOW), underruns(0), sent(0),
+          queuedUntil(std::chrono::steady_clock::now()), lastPoll(queuedUntil), isWriting(false), isStopping(false),
+          writer(&EbbConnection::stream, this) {}
+
+EbbConnection::~EbbConnection()
+{
+    close();
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        isStopping = true;
+    }
+    queueChanged.notify_all();
+    writer.join();
+}
+
+bool EbbConnection::tryOpen(const std::string &path)
+{
+    boost::system::error_code error;
+    port.open(path, error);
+    if (error) return false;
+
+    port.set_option(boost::asio::serial_port_base::baud_rate(9600), error);
+    port.set_option(boost::asio::serial_port_base::character_size(8), error);
+    port.set_option(boost::asio::serial_port_base::flow_control(boost::asio::serial_port_base::flow_control::none),
+                    error);
+
+    buffer.consume(buffer.size());
+    inFlight.clear();
+    readError.clear();
+    window = INITIAL_WINDOW;
+    underruns = sent = 0;
+
+    try
+    {
+        // "V" is the one query that is answered without a trailing "OK".
+        send("V", true, false);
+        waitForReply();
+        version = lastReply;
+    }
+    catch (const boost::system::system_error &)
+    {
+        version.clear();
+    }
+
+    if (version.find("EBB") == std::string::npos)
+    {
+        Log(Log::Type::DEBUG, "No EiBotBoard answered on \"" + path + "\".");
+
+        inFlight.clear();
+        port.close(error);
+        return false;
+    }
+
+    device = path;
+    Log(Log::Type::DEBUG, "Found EiBotBoard on \"" + path + "\": " + version);
+    return true;
+}
+
+bool EbbConnection::open(const std::string &path)
+{
+    close();
+    if (!path.empty()) return tryOpen(path);
+
+    // The board shows up as a USB CDC device; udev names it after the product where it can.
+    std::vector<std::string> candidates;
+    boost::system::error_code error;
+
+    for (const char *directory: {"/dev/serial/by-id", "/dev"})
+        for (boost::filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+        {
+            std::string name = it->path().filename().string();
+            if (name.find("EiBotBoard") != std::string::npos || name.rfind("ttyACM", 0) == 0 ||
+                name.rfind("cu.usbmodem", 0) == 0)
+                candidates.push_back(it->path().string());
+        }
+
+    return std::any_of(candidates.begin(), candidates.end(), [this](const std::string &candidate)
+    {
+        return tryOpen(candidate);
+    });
+}
+
+void EbbConnection::close()
+{
+    if (!port.is_open()) return;
+
+    flush();
+    Log(stats ? Log::Type::INFO : Log::Type::DEBUG,
+        "Sent " + std::to_string(sent) + " commands to the EiBotBoard, with up to " + std::to_string(window) +
+        " in flight and " + std::to_string(underruns) + " times the board ran out of motion.");
+
+    boost::system::error_code error;
+    port.close(error);
+}
+
+bool EbbConnection::isOpen() const
+{
+    return port.is_open();
+}
+
+const std::string &EbbConnection::getVersion() const
+{
+    return version;
+}
+
+void EbbConnection::startReading()
+{
+    if (isReading) return;
+    isReading = true;
+
+    boost::asio::async_read_until(port, buffer, '\n', [this](const boost::system::error_code &error, size_t)
+    {
+        isReading = false;
+        if (error)
+        {
+            readError = error;
+            return;
+        }
+
+        std::string line;
+        std::istream stream(&buffer);
+        std::getline(stream, line);
+
+        // Replies end in "\r\n", but some firmware versions send "\n\r", which leaves an empty line behind.
+        line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+        if (!line.empty()) receive(line);
+        if (!inFlight.empty()) startReading();
+    });
+}
+
+void EbbConnection::receive(const std::string &line)
+{
+    if (inFlight.empty())
+    {
+        Log(Log::Type::WARN, "Ignoring unexpected reply from the EiBotBoard: " + line);
+        return;
+    }
+
+    Pending &pending = inFlight.front();
+    if (line[0] == '!') Log(Log::Type::FATAL, "The EiBotBoard rejected \"" + pending.line + "\": " + line);
+
+    if (pending.isQuery && !pending.hasReply)
+    {
+        pending.hasReply = true;
+        lastReply = line;
+        if (pending.endsWithOk) return;
+    }
+    else if (line != "OK") Log(Log::Type::FATAL, "Unexpected reply to \"" + pending.line + "\": " + line);
+
+    // "QM,<command>,<motor 1>,<motor 2>,<FIFO>": all zeros means nothing is moving or queued (see command()).
+    if (pending.line == "QM" && lastReply.rfind("QM,0,0,0,0", 0) == 0)
+    {
+        underruns++;
+        window = std::min(window * 2, MAX_WINDOW);
+    }
+
+    inFlight.pop_front();
+}
+
+void EbbConnection::waitForReply()
+{
+    auto now = std::chrono::steady_clock::now();
+    auto timeout = std::chrono::milliseconds(RESPONSE_TIMEOUT_MS) +
+                   std::max(queuedUntil - now, std::chrono::steady_clock::duration::zero());
+    size_t waitingFor = inFlight.size();
+
+    startReading();
+    while (inFlight.size() == waitingFor && !readError)
+    {
+        io.restart();
+        if (io.run_one_for(timeout) == 0)
+        {
+            port.cancel();
+            io.restart();
+            io.run();
+
+            throw boost::system::system_error(boost::asio::error::timed_out,
+                                              "No reply to \"" + inFlight.front().line + "\"");
+        }
+    }
+
+    if (readError) throw boost::system::system_error(readError, "Could not read from the EiBotBoard");
+}
+
+void EbbConnection::send(const std::string &line, bool isQuery, bool endsWithOk)
+{
+    boost::asio::write(port, boost::asio::buffer(line + "\r"));
+
+    inFlight.push_back({line, isQuery, endsWithOk, false});
+    sent++;
+
+    // Handle whatever replies have already arrived, then wait while too many commands are unacknowledged.
+    startReading();
+    io.restart();
+    io.poll();
+
+    while (inFlight.size() > window) waitForReply();
+}
+
+void EbbConnection::stream()
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (true)
+    {
+        queueChanged.wait(lock, [this] { return isStopping || !queue.empty(); });
+        if (queue.empty()) return;
+
+        std::pair<std::string, double> next = std::move(queue.front());
+        queue.pop_front();
+        isWriting = true;
+
+        // The port is only touched here while the writer is busy, and only by the caller once it has drained.
+        lock.unlock();
+        transmit(next.first, next.second);
+        lock.lock();
+
+        isWriting = false;
+        queueChanged.notify_all();
+    }
+}
+
+void EbbConnection::transmit(const std::string &line, double motionMs)
+{
+    try
+    {
+        // The poll goes out just ahead of a move while earlier commands are still unacknowledged, so if the board is
+        // idle when it reads the poll, it ran out of motion before this move arrived.
+        auto now = std::chrono::steady_clock::now();
+        if (motionMs > 0 && !inFlight.empty() && now - lastPoll >= std::chrono::milliseconds(QUEUE_POLL_MS))
+        {
+            lastPoll = now;
+            send("QM", true, false);
+        }
+
+        send(line, false, false);
+        queuedUntil = std::max(queuedUntil, now) + std::chrono::microseconds(static_cast<int64_t>(motionMs * 1000));
+    }
+    catch (const boost::system::system_error &e)
+    {
+        Log(Log::Type::FATAL, std::string("Lost connection to AxiDraw: ") + e.what() + ".");
+    }
+}
+
+void EbbConnection::drain()
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    queueChanged.wait(lock, [this] { return queue.empty() && !isWriting; });
+}
+
+void EbbConnection::command(const std::string &line, double motionMs)
+{
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueChanged.wait(lock, [this] { return queue.size() < MAX_QUEUED; });
+        queue.emplace_back(line, motionMs);
+    }
+    queueChanged.notify_all();
+}
+
+void EbbConnection::flush()
+{
+    drain();
+    try
+    {
+        while (!inFlight.empty()) waitForReply();
+    }
+    catch (const boost::system::system_error &e)
+    {
+        Log(Log::Type::FATAL, std::string("Lost connection to AxiDraw: ") + e.what() + ".");
+    }
+}
+
+std::string EbbConnection::query(const std::string &line, bool endsWithOk)
+{
+    drain();
+    try
+    {
+        send(line, true, endsWithOk);
+    }
+    catch (const boost::system::system_error &e)
+    {
+        Log(Log::Type::FATAL, std::string("Lost connection to AxiDraw: ") + e.what() + ".");
+    }
+
+    flush();
+    return lastReply;
+}
+
+#pragma endregion
+
+EbbPlotter::EbbPlotter() : isInteractive(false), isPenUp(true) {}
+
+#pragma region General
+
+void EbbPlotter::setAcceleration(double acceleration)
+{
+    pending.acceleration = acceleration;
+    Log(Log::Type::DEBUG, "Set accel to " + std::to_string(acceleration) + ".");
+}
+
+void EbbPlotter::setPenUpPosition(double position)
+{
+    pending.penUpPosition = position;
+    Log(Log::Type::DEBUG, "Set pen_pos_up to " + std::to_string(position) + ".");
+}
+
+void EbbPlotter::setPenDownPosition(double position)
+{
+    pending.penDownPosition = position;
+    Log(Log::Type::DEBUG, "Set pen_pos_down to " + std::to_string(position) + ".");
+}
+
+void EbbPlotter::setPenUpDelay(double delay)
+{
+    pending.penUpDelay = delay;
+    Log(Log::Type::DEBUG, "Set pen_delay_up to " + std::to_string(delay) + ".");
+}
+
+void EbbPlotter::setPenDownDelay(double delay)
+{
+    pending.penDownDelay = delay;
+    Log(Log::Type::DEBUG, "Set pen_delay_down to " + std::to_string(delay) + ".");
+}
+
+void EbbPlotter::setPenUpSpeed(double speed)
+{
+    pending.penUpSpeed = speed;
+    Log(Log::Type::DEBUG, "Set speed_penup to " + std::to_string(speed) + ".");
+}
+
+void EbbPlotter::setPenDownSpeed(double speed)
+{
+    pending.penDownSpeed = speed;
+    Log(Log::Type::DEBUG, "Set speed_pendown to " + std::to_string(speed) + ".");
+}
+
+void EbbPlotter::setPenUpRate(double rate)
+{
+    pending.penUpRate = rate;
+    Log(Log::Type::DEBUG, "Set pen_rate_raise to " + std::to_string(rate) + ".");
+}
+
+void EbbPlotter::setPenDownRate(double rate)
+{
+    pending.penDownRate = rate;
+    Log(Log::Type::DEBUG, "Set pen_rate_lower to " + std::to_string(rate) + ".");
+}
+
+void EbbPlotter::setModel(int model)
+{
+    pending.model = std::clamp(model, 1, static_cast<int>(MODEL_COUNT) - 1);
+    Log(Log::Type::DEBUG, "Set model to " + std::to_string(model) + ".");
+}
+
+void EbbPlotter::setPort(const std::string &port)
+{
+    pending.port = port != "auto" ? port : "";
+    Log(Log::Type::DEBUG, "Set port to " + port + ".");
+}
+
+std::string EbbPlotter::getMode()
+{
+    std::string mode = isInteractive ? "interactive" : "plot";
+    Log(Log::Type::DEBUG, "  Mode is " + mode + ".");
+
+    return mode;
+}
+
+#pragma endregion
+#pragma region Interactive
+
+void EbbPlotter::modeInteractive()
+{
+    isInteractive = true;
+    Log(Log::Type::DEBUG, "Mode is set to interactive.");
+}
+
+void EbbPlotter::setUnits(int units)
+{
+    pending.units = std::clamp(units, 0, 2);
+    Log(Log::Type::DEBUG, "Set units to " + std::to_string(units) + ".");
+}
+
+void EbbPlotter::requireConnection(const char *command) const
+{
+    if (!connection.isOpen()) Log(Log::Type::FATAL, std::string("Cannot run ") + command + " before CONNECT.");
+}
+
+void EbbPlotter::configureServo()
+{
+    auto position = [](double percent)
+    {
+        return std::to_string(static_cast<int>(std::lround(SERVO_MIN + (SERVO_MAX - SERVO_MIN) * percent / 100)));
+    };
+    auto rate = [](double percent)
+    {
+        return std::to_string(std::max(1L, std::lround((SERVO_MAX - SERVO_MIN) * SERVO_UPDATE_MS / SERVO_SWEEP_MS *
+                                                       percent / 100)));
+    };
+
+    connection.command("SC,4," + position(active.penUpPosition));
+    connection.command("SC,5," + position(active.penDownPosition));
+    connection.command("SC,11," + rate(active.penUpRate));
+    connection.command("SC,12," + rate(active.penDownRate));
+}
+
+void EbbPlotter::connect()
+{
+    active = pending;
+    if (!connection.open(active.port)) Log(Log::Type::FATAL, "Could not connect to AxiDraw.");
+
+    connection.command("EM,1,1");
+    configureServo();
+
+    // "QP" answers 1 while the pen is up.
+    isPenUp = connection.query("QP") == "1";
+    setPen(true);
+
+    stepper.reset();
+    Log(Log::Type::DEBUG, "Connected to AxiDraw.");
+}
+
+void EbbPlotter::disconnect()
+{
+    connection.close();
+    Log(Log::Type::DEBUG, "Disconnected from AxiDraw.");
+}
+
+void EbbPlotter::updateOptions()
+{
+    active = pending;
+    if (connection.isOpen()) configureServo();
+
+    Log(Log::Type::DEBUG, "Updated options.");
+}
+
+void EbbPlotter::setPen(bool up)
+{
+    if (up == isPenUp) return;
+
+    double ms = servoMoveTime(std::abs(active.penUpPosition - active.penDownPosition),
+                              up ? active.penUpRate : active.penDownRate) +
+                std::max(up ? active.penUpDelay : active.penDownDelay, 0.0);
+
+    // The duration makes the board hold off the next motion command until the pen has settled.
+    connection.command(std::string("SP,") + (up ? "1," : "0,") + std::to_string(std::lround(ms)), ms);
+    isPenUp = up;
+}
+
+void EbbPlotter::moveTo(const Point *targets, size_t count, bool penDown)
+{
+    const ModelSpec &model = MODEL_SPECS[active.model];
+    double unitsPerInch = UNITS_PER_INCH[active.units];
+
+    // The path starts where the carriage is. Targets outside the travel envelope are clamped, like pyaxidraw does.
+    waypoints.assign(1, stepper.getPosition());
+    for (size_t i = 0; i < count; i++)
+        waypoints.push_back(Rect{0, 0, model.width, model.height}.clamp({targets[i].x / unitsPerInch,
+                                                                    targets[i].y / unitsPerInch}));
+
+    MotionPlanner planner(motionLimits(penDown, penDown ? active.penDownSpeed : active.penUpSpeed,
+                                       active.acceleration));
+    packets.clear();
+    stepper.compile(planner.plan(waypoints.data(), waypoints.size()), packets);
+
+    // Everything is in whole steps and milliseconds by now. The packets are only queued: the connection streams them
+    // while the executor moves on and the next path is planned.
+    setPen(!penDown);
+    for (const StepPacket &packet: packets)
+        connection.command("SM," + std::to_string(packet.milliseconds) + "," + std::to_string(packet.motor1) + "," +
+                           std::to_string(packet.motor2), packet.milliseconds);
+}
+
+void EbbPlotter::penUp()
+{
+    requireConnection("PENUP");
+    setPen(true);
+    Log(Log::Type::DEBUG, "Pen is up.");
+}
+
+void EbbPlotter::penDown()
+{
+    requireConnection("PENDOWN");
+    setPen(false);
+    Log(Log::Type::DEBUG, "Pen is down.");
+}
+
+void EbbPlotter::penToggle()
+{
+    requireConnection("PENTOGGLE");
+    setPen(!isPenUp);
+    Log(Log::Type::DEBUG, std::string("Pen toggled to ") + (isPenUp ? "up" : "down") + ".");
+}
+
+void EbbPlotter::home()
+{
+    requireConnection("HOME");
+    Point target = {0, 0};
+    moveTo(&target, 1, false);
+    Log(Log::Type::DEBUG, "Moved to home.");
+}
+
+void EbbPlotter::goTo(double x, double y)
+{
+    requireConnection("GOTO");
+    Point target = {x, y};
+    moveTo(&target, 1, false);
+    Log(Log::Type::DEBUG, "Moved to (" + std::to_string(x) + ", " + std::to_string(y) + ").");
+}
+
+void EbbPlotter::goToRelative(double x, double y)
+{
+    requireConnection("GOTO_REL");
+
+    std::pair<double, double> position = getPosition();
+    Point target = {position.first + x, position.second + y};
+    moveTo(&target, 1, false);
+    Log(Log::Type::DEBUG, "Moved to (" + std::to_string(x) + ", " + std::to_string(y) + ") relatively.");
+}
+
+void EbbPlotter::draw(const Point *path, size_t count)
+{
+    requireConnection("DRAW");
+
+    if (count == 0) return;
+
+    // The whole path is planned at once, so the carriage only slows down as much as each corner needs.
+    moveTo(path, 1, false);
+    if (count > 1) moveTo(path + 1, count - 1, true);
+
+    Log(Log::Type::DEBUG, "Drew a path of " + std::to_string(count) + " points to (" +
+                          std::to_string(path[count - 1].x) + ", " + std::to_string(path[count - 1].y) + ").");
+}
+
+void EbbPlotter::wait(double ms)
+{
+    requireConnection("WAIT");
+
+    // A motion command without steps queues the delay behind the moves that are still running.
+    double duration = std::clamp(ms, 0.0, 16777215.0);
+    if (duration >= 1) connection.command("SM," + std::to_string(std::lround(duration)) + ",0,0", duration);
+    Log(Log::Type::DEBUG, "Waited for " + std::to_string(ms) + " ms.");
+}
+
+std::pair<double, double> EbbPlotter::getPosition()
+{
+    double unitsPerInch = UNITS_PER_INCH[active.units];
+    Point point = stepper.getPosition();
+    std::pair<double, double> position = {point.x * unitsPerInch, point.y * unitsPerInch};
+
+    Log(Log::Type::DEBUG,
+        "Current position is (" + std::to_string(position.first) + ", " + std::to_string(position.second) + ").");
+    return position;
+}
+
+bool EbbPlotter::getPen()
+{
+    // True while the pen is down, which is how the executor reports it.
+    Log(Log::Type::DEBUG, std::string("Pen status is ") + (isPenUp ? "up" : "down") + ".");
+    return !isPenUp;
+}
+
+void EbbPlotter::sync()
+{
+    requireConnection("SYNC");
+
+    // The position is counted in steps from home, which is all the board knows too, so only the pen is read back.
+    isPenUp = connection.query("QP") == "1";
+    Log(Log::Type::DEBUG, std::string("Synced with AxiDraw: pen ") + (isPenUp ? "up" : "down") + ".");
+}
+
+#pragma endregion
+#pragma region Plot
+
+void EbbPlotter::modePlot(const std::string &)
+{
+    Log(Log::Type::FATAL, "Plotting SVG files needs the pyaxidraw backend (--backend pyaxidraw).");
+}
+
+void EbbPlotter::runPlot()
+{
+    Log(Log::Type::FATAL, "Plotting SVG files needs the pyaxidraw backend (--backend pyaxidraw).");
+}
+
+#pragma endregion
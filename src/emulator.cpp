@@ -0,0 +1,296 @@
+#include "include/emulator.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "include/stepper.h"
+
+static constexpr const char *VERSION = "EBBv13_and_above EB Firmware Version 2.8.1";
+// Longest duration the board accepts for a motion command, in milliseconds.
+static constexpr double MAX_MOVE_MS = 16777215;
+
+static volatile std::sig_atomic_t isInterrupted = 0;
+
+static void interrupt(int)
+{
+    isInterrupted = 1;
+}
+
+static std::vector<std::string> splitFields(const std::string &line)
+{
+    std::vector<std::string> fields;
+    size_t begin = 0;
+
+    for (size_t end; (end = line.find(',', begin)) != std::string::npos; begin = end + 1)
+        fields.push_back(line.substr(begin, end - begin));
+    fields.push_back(line.substr(begin));
+
+    return fields;
+}
+
+static bool parseNumber(const std::string &field, double &value)
+{
+    char *end = nullptr;
+    value = std::strtod(field.c_str(), &end);
+
+    return !field.empty() && end == field.c_str() + field.size();
+}
+
+static double toSeconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<double>(duration).count();
+}
+
+EbbEmulator::EbbEmulator(double latencyMs, size_t fifoDepth, const std::string &logPath)
+        : latency(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(latencyMs))),
+          fifoDepth(fifoDepth), master(-1)
+{
+    if (!logPath.empty())
+    {
+        log.open(logPath);
+        if (!log) Log(Log::Type::FATAL, "Could not open \"" + logPath + "\" for writing.");
+
+        log << "time_ms,command,duration_ms,motor1,motor2,x,y,pen" << std::endl;
+    }
+
+    resetSession();
+}
+
+EbbEmulator::~EbbEmulator()
+{
+    if (master >= 0) ::close(master);
+}
+
+void EbbEmulator::openTerminal()
+{
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+        Log(Log::Type::FATAL, std::string("Could not open a pseudo-terminal: ") + std::strerror(errno));
+
+    std::string device = ptsname(master);
+
+    // Raw mode, so that "\r" is not turned into "\n" on the way. It sticks to the terminal for as long as the master
+    // side is open, so the device can be closed again right away; the master then sees a hangup until the plotter
+    // opens it.
+    int slave = ::open(device.c_str(), O_RDWR | O_NOCTTY);
+    termios settings{};
+    if (slave < 0 || tcgetattr(slave, &settings) != 0)
+        Log(Log::Type::FATAL, "Could not set up \"" + device + "\": " + std::strerror(errno));
+
+    cfmakeraw(&settings);
+    tcsetattr(slave, TCSANOW, &settings);
+    ::close(slave);
+
+    Log(Log::Type::INFO, "Emulating an EiBotBoard on \"" + device + "\". Press Ctrl+C to stop.");
+}
+
+void EbbEmulator::resetSession()
+{
+    received.clear();
+    inbox.clear();
+    outbox.clear();
+
+    isConnected = false;
+    isPenUp = true;
+    motor1 = motor2 = 0;
+    commands = motionCommands = 0;
+    motionTime = idleTime = Clock::duration::zero();
+}
+
+void EbbEmulator::printSummary() const
+{
+    auto x = static_cast<double>(motor1 + motor2) / 2, y = static_cast<double>(motor1 - motor2) / 2;
+
+    Log(Log::Type::INFO, "Plotter disconnected after " + std::to_string(toSeconds(Clock::now() - start)) + " s.\n" +
+                         "  Commands:    " + std::to_string(commands) + " (" + std::to_string(motionCommands) +
+                         " motion)\n" +
+                         "  Motion time: " + std::to_string(toSeconds(motionTime)) + " s\n" +
+                         "  Idle time:   " + std::to_string(toSeconds(idleTime)) + " s between moves\n" +
+                         "  Position:    (" + std::to_string(x / StepCompiler::STEPS_PER_INCH) + ", " +
+                         std::to_string(y / StepCompiler::STEPS_PER_INCH) + ") in, pen " + (isPenUp ? "up" : "down"));
+}
+
+void EbbEmulator::run()
+{
+    openTerminal();
+    std::signal(SIGINT, interrupt);
+    std::signal(SIGTERM, interrupt);
+
+    while (!isInterrupted)
+    {
+        Clock::time_point now = Clock::now();
+        while (processCommand(now));
+        writeOutput(now);
+
+        // Sleep until the next line is due either way, or the move holding up the next command ends.
+        Clock::time_point wake = Clock::time_point::max();
+        if (!inbox.empty()) wake = inbox.front().due > now ? inbox.front().due : moves.front();
+        if (!outbox.empty()) wake = std::min(wake, outbox.front().due);
+
+        int timeout = wake == Clock::time_point::max() ? -1 : static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(wake - now + std::chrono::microseconds(999))
+                        .count());
+
+        pollfd descriptor = {master, POLLIN, 0};
+        int ready = poll(&descriptor, 1, std::max(timeout, 0));
+        if (ready < 0 && errno != EINTR)
+            Log(Log::Type::FATAL, std::string("Could not read from the pseudo-terminal: ") + std::strerror(errno));
+
+        if (ready > 0 && (descriptor.revents & POLLIN)) readInput(Clock::now());
+        else if (ready > 0 && (descriptor.revents & (POLLHUP | POLLERR)))
+        {
+            // Nothing has the device open.
+            if (isConnected) printSummary();
+            resetSession();
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    if (isConnected) printSummary();
+}
+
+void EbbEmulator::readInput(Clock::time_point now)
+{
+    char data[4096];
+    ssize_t count = ::read(master, data, sizeof(data));
+    if (count <= 0) return;
+
+    if (!isConnected)
+    {
+        isConnected = true;
+        start = now;
+        Log(Log::Type::DEBUG, "Plotter connected.");
+    }
+
+    received.append(data, static_cast<size_t>(count));
+    for (size_t end; (end = received.find('\r')) != std::string::npos; received.erase(0, end + 1))
+    {
+        std::string line = received.substr(0, end);
+        line.erase(0, line.find_first_not_of("\n "));
+        if (!line.empty()) inbox.push_back({now + latency / 2, line});
+    }
+}
+
+void EbbEmulator::writeOutput(Clock::time_point now)
+{
+    while (!outbox.empty() && outbox.front().due <= now)
+    {
+        // A write can only fail once the plotter is gone, which the next poll() reports.
+        if (::write(master, outbox.front().text.data(), outbox.front().text.size()) < 0) return;
+        outbox.pop_front();
+    }
+}
+
+bool EbbEmulator::processCommand(Clock::time_point now)
+{
+    if (inbox.empty() || inbox.front().due > now) return false;
+
+    while (!moves.empty() && moves.front() <= now) moves.pop_front();
+
+    // The board parses one command at a time, so a motion command waiting for room in the FIFO holds up everything
+    // after it.
+    const std::string &line = inbox.front().text;
+    bool isMotion = line.rfind("SM,", 0) == 0 || line.rfind("SP,", 0) == 0 || line.rfind("TP", 0) == 0;
+    if (isMotion && moves.size() > fifoDepth) return false;
+
+    std::string reply = answer(line, now);
+    inbox.pop_front();
+    outbox.push_back({now + latency / 2, reply});
+
+    return true;
+}
+
+void EbbEmulator::queueMove(double ms, Clock::time_point now)
+{
+    Clock::time_point begin = moves.empty() ? now : moves.back();
+    if (motionCommands > 0 && begin > lastMoveEnd) idleTime += begin - lastMoveEnd;
+
+    auto duration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms));
+    moves.push_back(begin + duration);
+
+    lastMoveEnd = moves.back();
+    motionTime += duration;
+    motionCommands++;
+}
+
+std::string EbbEmulator::answer(const std::string &line, Clock::time_point now)
+{
+    static const std::string OK = "OK\r\n";
+    std::vector<std::string> fields = splitFields(line);
+    const std::string &name = fields[0];
+    commands++;
+
+    auto invalid = [&]() { return "!8 Err: Invalid parameters for " + name + "\r\n"; };
+    auto record = [&](double ms)
+    {
+        if (!log.is_open()) return;
+
+        Clock::time_point begin = moves.empty() ? now : std::max(now, moves.back());
+        // CoreXY: X and Y are the half sum and half difference of the motor steps, logged in inches.
+        log << toSeconds(begin - start) * 1000 << "," << name << "," << ms << "," << motor1 << "," << motor2 << ","
+            << static_cast<double>(motor1 + motor2) / 2 / StepCompiler::STEPS_PER_INCH << ","
+            << static_cast<double>(motor1 - motor2) / 2 / StepCompiler::STEPS_PER_INCH << ","
+            << (isPenUp ? "up" : "down") << "\n";
+    };
+
+    if (name == "V") return std::string(VERSION) + "\r\n";
+    if (name == "QP") return std::string(isPenUp ? "1" : "0") + "\r\n" + OK;
+    if (name == "QS") return std::to_string(motor1) + "," + std::to_string(motor2) + "\r\n" + OK;
+    if (name == "QB") return "0\r\n" + OK;
+    if (name == "QE") return "16,16\r\n" + OK;
+    if (name == "QM")
+    {
+        // "QM,<command>,<motor 1>,<motor 2>,<FIFO>", without an "OK".
+        bool isMoving = !moves.empty(), isQueued = moves.size() > 1;
+        return std::string("QM,") + (isMoving ? "1," : "0,") + (isMoving ? "1," : "0,") + (isMoving ? "1," : "0,") +
+               (isQueued ? "1" : "0") + "\r\n";
+    }
+
+    if (name == "SM")
+    {
+        double ms, steps1, steps2;
+        if (fields.size() < 3 || !parseNumber(fields[1], ms) || !parseNumber(fields[2], steps1) || ms < 1 ||
+            ms > MAX_MOVE_MS || (fields.size() > 3 && !parseNumber(fields[3], steps2)))
+            return invalid();
+        if (fields.size() <= 3) steps2 = 0;
+
+        motor1 += static_cast<int64_t>(steps1);
+        motor2 += static_cast<int64_t>(steps2);
+        record(ms);
+        queueMove(ms, now);
+        return OK;
+    }
+
+    if (name == "SP" || name == "TP")
+    {
+        double value = 0, ms = 0;
+        size_t durationField = name == "SP" ? 2 : 1;
+        if ((name == "SP" && (fields.size() < 2 || !parseNumber(fields[1], value))) ||
+            (fields.size() > durationField && !parseNumber(fields[durationField], ms)) || ms < 0 || ms > MAX_MOVE_MS)
+            return invalid();
+
+        isPenUp = name == "SP" ? value == 1 : !isPenUp;
+        record(ms);
+        queueMove(ms, now);
+        return OK;
+    }
+
+    if (name == "CS")
+    {
+        motor1 = motor2 = 0;
+        return OK;
+    }
+
+    if (name == "EM" || name == "SC" || name == "SR" || name == "R") return OK;
+    return "!8 Err: Unknown command " + name + "\r\n";
+}
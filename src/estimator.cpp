@@ -0,0 +1,132 @@
+#include "include/estimator.h"
+
+Estimator::Estimator() : settings(), isPenUp(true), position({0, 0})
+{
+    reset();
+}
+
+void Estimator::reset()
+{
+    settings[Token::Type::Acceleration] = 75;
+    settings[Token::Type::PenUpPosition] = 60;
+    settings[Token::Type::PenDownPosition] = 30;
+    settings[Token::Type::PenUpDelay] = 0;
+    settings[Token::Type::PenDownDelay] = 0;
+    settings[Token::Type::PenUpSpeed] = 75;
+    settings[Token::Type::PenDownSpeed] = 25;
+    settings[Token::Type::PenUpRate] = 75;
+    settings[Token::Type::PenDownRate] = 50;
+    settings[Token::Type::Model] = 1;
+    settings[Token::Type::Units] = 0;
+
+    isPenUp = true;
+    position = {0, 0};
+}
+
+void Estimator::movePen(Estimate &estimate, bool up)
+{
+    if (up == isPenUp) return;
+
+    double ms = servoMoveTime(std::abs(settings[Token::Type::PenUpPosition] - settings[Token::Type::PenDownPosition]),
+                              settings[up ? Token::Type::PenUpRate : Token::Type::PenDownRate]);
+
+    estimate.seconds += (ms + std::max(settings[up ? Token::Type::PenUpDelay : Token::Type::PenDownDelay], 0.0)) / 1000;
+    if (up) estimate.penLifts++;
+    isPenUp = up;
+}
+
+Point Estimator::toInches(const Point &point) const
+{
+    double unitsPerInch = UNITS_PER_INCH[std::clamp(static_cast<int>(settings[Token::Type::Units]), 0, 2)];
+    const ModelSpec &model = MODEL_SPECS[std::clamp(static_cast<size_t>(settings[Token::Type::Model]), size_t(1),
+                                                    MODEL_COUNT - 1)];
+
+    return Rect{0, 0, model.width, model.height}.clamp({point.x / unitsPerInch, point.y / unitsPerInch});
+}
+
+void Estimator::travel(Estimate &estimate, const Point *targets, size_t count, bool penDown)
+{
+    movePen(estimate, !penDown);
+
+    path.assign(1, position);
+    for (size_t i = 0; i < count; i++) path.push_back(toInches(targets[i]));
+
+    MotionPlanner planner(motionLimits(penDown, settings[penDown ? Token::Type::PenDownSpeed : Token::Type::PenUpSpeed],
+                                       settings[Token::Type::Acceleration]));
+    for (const PlannedMove &move: planner.plan(path.data(), path.size()))
+    {
+        estimate.seconds += move.duration();
+        (penDown ? estimate.penDownDistance : estimate.penUpDistance) += move.length;
+    }
+
+    position = path.back();
+}
+
+Estimate Estimator::estimate(const ProgramView &program, std::map<uint32_t, Estimate> *lines)
+{
+    Estimate total;
+    reset();
+
+    for (size_t index = 0; index < program.instructionCount; index++)
+    {
+        const Instruction &instruction = program.instructions[index];
+        Estimate estimate;
+
+        switch (instruction.op)
+        {
+            case Instruction::Op::Options:
+            case Instruction::Op::UpdateOptions:
+            {
+                for (uint32_t i = 0; i < instruction.count; i++)
+                {
+                    const Option &option = program.options[instruction.first + i];
+                    if (option.name != Token::Type::Port) settings[option.name] = option.value;
+                }
+                break;
+            }
+            case Instruction::Op::Connect:
+                position = {0, 0};
+                break;
+            case Instruction::Op::PenUp:
+                movePen(estimate, true);
+                break;
+            case Instruction::Op::PenDown:
+                movePen(estimate, false);
+                break;
+            case Instruction::Op::PenToggle:
+                movePen(estimate, !isPenUp);
+                break;
+            case Instruction::Op::Move:
+            {
+                Point target = {instruction.x, instruction.y};
+                travel(estimate, &target, 1, false);
+                break;
+            }
+            case Instruction::Op::MoveRelative:
+            {
+                double unitsPerInch = UNITS_PER_INCH[std::clamp(static_cast<int>(settings[Token::Type::Units]), 0, 2)];
+                Point target = {position.x * unitsPerInch + instruction.x, position.y * unitsPerInch + instruction.y};
+                travel(estimate, &target, 1, false);
+                break;
+            }
+            case Instruction::Op::Draw:
+            {
+                travel(estimate, program.points + instruction.first, 1, false);
+                if (instruction.count > 1)
+                    travel(estimate, program.points + instruction.first + 1, instruction.count - 1, true);
+
+                break;
+            }
+            case Instruction::Op::Wait:
+                estimate.seconds += std::max(instruction.x, 0.0) / 1000;
+                break;
+            default:
+                break;
+        }
+
+        total += estimate;
+        if (lines) (*lines)[instruction.line] += estimate;
+    }
+
+    return total;
+}
@@ -0,0 +1,187 @@
+#include "include/executor.h"
+
+static std::string downloadFile(const std::string &url, int redirectLevel = 1)
+{
+    auto writeCallback = [](char *contents, size_t size, size_t nmemb, std::string *buffer)
+    {
+        size_t realSize = size * nmemb;
+        buffer->append(contents, realSize);
+
+        return realSize;
+    };
+
+    if (redirectLevel > MAX_REDIRECTS) Log(Log::Type::FATAL, "Too many redirects.");
+
+    Log(Log::Type::DEBUG, std::string(redirectLevel * 2, ' ') + "Downloading file from \"" + sanitize(url) + "\".");
+    Log(Log::Type::DEBUG, std::string(redirectLevel * 2, ' ') + "Resolving URL.");
+
+    CURL *curl = curl_easy_init();
+    if (!curl) Log(Log::Type::FATAL, "Could not initialize cURL.");
+
+    std::string userAgent = "AxiLang/" + std::string(PROJECT_VERSION);
+    std::string buffer;
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, MAX_REDIRECTS);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, userAgent.c_str());
+
+    CURLcode res = curl_easy_perform(curl);
+    if (res != CURLE_OK) Log(Log::Type::FATAL, "Could not download file from \"" + sanitize(url) + "\".");
+
+    long responseCode;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode);
+    if (responseCode == 301 || responseCode == 302)
+    {
+        char *redirectUrl;
+        curl_easy_getinfo(curl, CURLINFO_REDIRECT_URL, &redirectUrl);
+
+        Log(Log::Type::DEBUG,
+            std::string(redirectLevel * 2, ' ') + "Redirecting to \"" + sanitize(redirectUrl) + "\".");
+        curl_easy_cleanup(curl);
+
+        return downloadFile(redirectUrl, redirectLevel + 1);
+    }
+
+    curl_easy_cleanup(curl);
+    Log(Log::Type::DEBUG, std::string(redirectLevel * 2, ' ') + "Creating temporary file.");
+
+    boost::filesystem::path temp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    std::ofstream file;
+    file.open(temp.string(), std::ios::out | std::ios::binary);
+
+    if (!file.is_open())
+        Log(Log::Type::FATAL, std::string(redirectLevel * 2, ' ') + "Could not create temporary file for plot.");
+
+    file << buffer;
+    file.close();
+
+    Log(Log::Type::DEBUG, std::string(redirectLevel * 2, ' ') + "Saved to: " + temp.string());
+    return temp.string();
+}
+
+Executor::Executor(const std::string &backend) : plotter(Plotter::create(backend)) {}
+
+void Executor::setOption(const ProgramView &program, const Option &option)
+{
+    switch (option.name)
+    {
+        case Token::Type::Acceleration:
+            plotter->setAcceleration(option.value);
+            break;
+        case Token::Type::PenUpPosition:
+            plotter->setPenUpPosition(option.value);
+            break;
+        case Token::Type::PenDownPosition:
+            plotter->setPenDownPosition(option.value);
+            break;
+        case Token::Type::PenUpDelay:
+            plotter->setPenUpDelay(option.value);
+            break;
+        case Token::Type::PenDownDelay:
+            plotter->setPenDownDelay(option.value);
+            break;
+        case Token::Type::PenUpSpeed:
+            plotter->setPenUpSpeed(option.value);
+            break;
+        case Token::Type::PenDownSpeed:
+            plotter->setPenDownSpeed(option.value);
+            break;
+        case Token::Type::PenUpRate:
+            plotter->setPenUpRate(option.value);
+            break;
+        case Token::Type::PenDownRate:
+            plotter->setPenDownRate(option.value);
+            break;
+        case Token::Type::Model:
+            plotter->setModel(static_cast<int>(option.value));
+            break;
+        case Token::Type::Port:
+            plotter->setPort(std::string(program.text(option.first, option.count)));
+            break;
+        case Token::Type::Units:
+            plotter->setUnits(static_cast<int>(option.value));
+            break;
+        default:
+            break;
+    }
+}
+
+void Executor::run(const ProgramView &program)
+{
+    for (size_t index = 0; index < program.instructionCount; index++)
+    {
+        const Instruction &instruction = program.instructions[index];
+
+        switch (instruction.op)
+        {
+            case Instruction::Op::InteractiveMode:
+                plotter->modeInteractive();
+                break;
+            case Instruction::Op::PlotMode:
+                break;
+            case Instruction::Op::Options:
+            case Instruction::Op::UpdateOptions:
+            {
+                for (uint32_t i = 0; i < instruction.count; i++)
+                    setOption(program, program.options[instruction.first + i]);
+
+                if (instruction.op == Instruction::Op::UpdateOptions) plotter->updateOptions();
+                break;
+            }
+            case Instruction::Op::Connect:
+                plotter->connect();
+                break;
+            case Instruction::Op::Disconnect:
+                plotter->disconnect();
+                break;
+            case Instruction::Op::PenUp:
+                plotter->penUp();
+                break;
+            case Instruction::Op::PenDown:
+                plotter->penDown();
+                break;
+            case Instruction::Op::PenToggle:
+                plotter->penToggle();
+                break;
+            case Instruction::Op::Move:
+                plotter->goTo(instruction.x, instruction.y);
+                break;
+            case Instruction::Op::MoveRelative:
+                plotter->goToRelative(instruction.x, instruction.y);
+                break;
+            case Instruction::Op::Draw:
+                plotter->draw(program.points + instruction.first, instruction.count);
+                break;
+            case Instruction::Op::Wait:
+                plotter->wait(instruction.x);
+                break;
+            case Instruction::Op::GetPos:
+            {
+                std::pair<double, double> pos = plotter->getPosition();
+                Log(Log::Type::INFO, "X: " + std::to_string(pos.first) + ", Y: " + std::to_string(pos.second));
+
+                break;
+            }
+            case Instruction::Op::GetPen:
+                Log(Log::Type::INFO, std::string("Pen is ") + (plotter->getPen() ? "down" : "up") + ".");
+                break;
+            case Instruction::Op::Sync:
+                plotter->sync();
+                break;
+            case Instruction::Op::SetPlot:
+            {
+                std::string filePath(program.text(instruction.first, instruction.count));
+                if (std::regex_match(filePath, std::regex("https?://.*"))) filePath = downloadFile(filePath);
+
+                plotter->modePlot(filePath);
+                break;
+            }
+            case Instruction::Op::Plot:
+                plotter->runPlot();
+                break;
+        }
+    }
+}
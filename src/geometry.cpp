@@ -0,0 +1,324 @@
+#include "include/geometry.h"
+
+void clipSegments(const Point *points, size_t count, const Rect &rect, double *enter, double *exit)
+{
+    for (size_t i = 0; i + 1 < count; i++)
+    {
+        double x = points[i].x, y = points[i].y, dx = points[i + 1].x - x, dy = points[i + 1].y - y;
+        double low = 0, high = 1;
+
+        // For each border, p is the speed towards the outside and q the distance to it; a segment parallel to a
+        // border (p = 0) is either entirely inside it or entirely outside.
+        const double ps[4] = {-dx, dx, -dy, dy};
+        const double qs[4] = {x - rect.minX, rect.maxX - x, y - rect.minY, rect.maxY - y};
+
+        for (int border = 0; border < 4; border++)
+        {
+            double p = ps[border], q = qs[border], r = q / (p != 0 ? p : 1);
+
+            low = p < 0 ? std::max(low, r) : low;
+            high = p > 0 ? std::min(high, r) : high;
+            high = p == 0 && q < 0 ? -1 : high;
+        }
+
+        enter[i] = low;
+        exit[i] = high;
+    }
+}
+
+// Points this close to the line through their neighbours (relative to the distance between them) count as collinear.
+static constexpr double COLLINEAR_EPSILON = 1e-9;
+
+void simplifyPolyline(const Point *points, size_t count, double tolerance, uint8_t *keep)
+{
+    std::fill(keep, keep + count, 0);
+    if (count == 0) return;
+
+    keep[0] = keep[count - 1] = 1;
+    if (count <= 2) return;
+
+    // Merge runs of repeated points and points that lie on the segment between their neighbours. This is exact (up to
+    // rounding), and cheap enough to shrink long straight stretches before Ramer-Douglas-Peucker, which takes
+    // O(n log n) when its splits are balanced but O(n^2) when each one only peels off an end point.
+    std::vector<uint32_t> candidates;
+    candidates.reserve(count);
+    candidates.push_back(0);
+
+    for (size_t i = 1; i + 1 < count; i++)
+    {
+        const Point &a = points[candidates.back()], &b = points[i], &c = points[i + 1];
+        double abx = b.x - a.x, aby = b.y - a.y, acx = c.x - a.x, acy = c.y - a.y;
+        double length = acx * acx + acy * acy, along = abx * acx + aby * acy;
+
+        if (b == a || (std::abs(abx * acy - aby * acx) <= COLLINEAR_EPSILON * length && along >= 0 &&
+                       along <= length))
+            continue;
+
+        candidates.push_back(static_cast<uint32_t>(i));
+    }
+    candidates.push_back(static_cast<uint32_t>(count - 1));
+
+    // Ramer-Douglas-Peucker, with an explicit stack since exported paths can have millions of points.
+    std::vector<std::pair<size_t, size_t>> ranges = {{0, candidates.size() - 1}};
+    double toleranceSquared = tolerance * tolerance;
+
+    while (!ranges.empty())
+    {
+        auto [from, to] = ranges.back();
+        ranges.pop_back();
+        if (to - from < 2) continue;
+
+        const Point &a = points[candidates[from]], &b = points[candidates[to]];
+        double farthest = -1;
+        size_t split = from;
+
+        for (size_t i = from + 1; i < to; i++)
+        {
+            double candidateDistance = distanceToSegmentSquared(points[candidates[i]], a, b);
+            if (candidateDistance > farthest)
+            {
+                farthest = candidateDistance;
+                split = i;
+            }
+        }
+
+        if (farthest <= toleranceSquared) continue;
+
+        keep[candidates[split]] = 1;
+        ranges.emplace_back(from, split);
+        ranges.emplace_back(split, to);
+    }
+}
+
+// Average number of points per cell.
+static constexpr double POINTS_PER_CELL = 2;
+
+PointGrid::PointGrid(const std::vector<Point> &points)
+        : points(points), origin({0, 0}), cellSize(1), columns(1), rows(1), slots(points.size()), live(points.size()),
+          builtWith(0)
+{
+    for (uint32_t id = 0; id < points.size(); id++) slots[id] = id;
+    build();
+}
+
+void PointGrid::build()
+{
+    std::vector<uint32_t> remaining;
+    remaining.reserve(live);
+    for (uint32_t id = 0; id < slots.size(); id++) if (slots[id] != UINT32_MAX) remaining.push_back(id);
+
+    Point low = {0, 0}, high = {0, 0};
+    if (!remaining.empty()) low = high = points[remaining.front()];
+    for (uint32_t id: remaining)
+    {
+        low = {std::min(low.x, points[id].x), std::min(low.y, points[id].y)};
+        high = {std::max(high.x, points[id].x), std::max(high.y, points[id].y)};
+    }
+
+    double width = high.x - low.x, height = high.y - low.y;
+    double cells = std::max(static_cast<double>(remaining.size()) / POINTS_PER_CELL, 1.0);
+
+    // Square cells sized for the wanted count, or thin strips if all the points are on one line.
+    origin = low;
+    cellSize = std::max({std::sqrt(width * height / cells), std::max(width, height) / cells, 1e-9});
+    columns = static_cast<size_t>(width / cellSize) + 1;
+    rows = static_cast<size_t>(height / cellSize) + 1;
+
+    cellStart.assign(columns * rows + 1, 0);
+    cellCount.assign(columns * rows, 0);
+    ids.resize(remaining.size());
+
+    std::vector<size_t> cellIds(remaining.size());
+    for (size_t i = 0; i < remaining.size(); i++)
+    {
+        int64_t x, y;
+        cellOf(points[remaining[i]], x, y);
+
+        cellIds[i] = static_cast<size_t>(y) * columns + static_cast<size_t>(x);
+        cellCount[cellIds[i]]++;
+    }
+
+    for (size_t cell = 0; cell < cellCount.size(); cell++) cellStart[cell + 1] = cellStart[cell] + cellCount[cell];
+
+    std::vector<uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+    for (size_t i = 0; i < remaining.size(); i++)
+    {
+        uint32_t slot = fill[cellIds[i]]++;
+        ids[slot] = remaining[i];
+        slots[remaining[i]] = slot;
+    }
+
+    builtWith = remaining.size();
+}
+
+void PointGrid::cellOf(const Point &point, int64_t &x, int64_t &y) const
+{
+    // Points outside the grid are clamped to the nearest border cell, which keeps the search bounds conservative.
+    x = std::clamp<int64_t>(static_cast<int64_t>(std::floor((point.x - origin.x) / cellSize)), 0,
+                            static_cast<int64_t>(columns) - 1);
+    y = std::clamp<int64_t>(static_cast<int64_t>(std::floor((point.y - origin.y) / cellSize)), 0,
+                            static_cast<int64_t>(rows) - 1);
+}
+
+size_t PointGrid::size() const
+{
+    return live;
+}
+
+bool PointGrid::contains(uint32_t id) const
+{
+    return slots[id] != UINT32_MAX;
+}
+
+void PointGrid::remove(uint32_t id)
+{
+    if (!contains(id)) return;
+
+    int64_t x, y;
+    cellOf(points[id], x, y);
+    size_t cell = static_cast<size_t>(y) * columns + static_cast<size_t>(x);
+
+    // Swap with the last point still in the cell.
+    uint32_t last = cellStart[cell] + --cellCount[cell];
+    std::swap(ids[slots[id]], ids[last]);
+    slots[ids[slots[id]]] = slots[id];
+    slots[id] = UINT32_MAX;
+
+    if (--live > 0 && live * 4 < builtWith) build();
+}
+
+bool PointGrid::nearest(const Point &point, uint32_t &id)
+{
+    if (live == 0) return false;
+
+    int64_t centerX, centerY;
+    cellOf(point, centerX, centerY);
+
+    double best = INFINITY;
+    auto maxRing = static_cast<int64_t>(std::max(columns, rows));
+
+    for (int64_t ring = 0; ring <= maxRing; ring++)
+    {
+        for (int64_t y = centerY - ring; y <= centerY + ring; y++)
+        {
+            if (y < 0 || y >= static_cast<int64_t>(rows)) continue;
+
+            // Inner rows of the ring only have their two end cells.
+            bool isEdgeRow = y == centerY - ring || y == centerY + ring;
+            for (int64_t x = centerX - ring; x <= centerX + ring; x += isEdgeRow || ring == 0 ? 1 : 2 * ring)
+            {
+                if (x < 0 || x >= static_cast<int64_t>(columns)) continue;
+
+                size_t cell = static_cast<size_t>(y) * columns + static_cast<size_t>(x);
+                for (uint32_t i = cellStart[cell]; i < cellStart[cell] + cellCount[cell]; i++)
+                {
+                    double candidate = distanceSquared(points[ids[i]], point);
+                    if (candidate < best)
+                    {
+                        best = candidate;
+                        id = ids[i];
+                    }
+                }
+            }
+        }
+
+        // Anything in the next ring is at least this far away.
+        double bound = static_cast<double>(ring) * cellSize;
+        if (best <= bound * bound) break;
+    }
+
+    return true;
+}
+
+// Grid coordinates beyond this would overflow the products used to compare lines.
+static constexpr double MAX_GRID_COORDINATE = 1 << 30;
+
+SegmentSet::SegmentSet(double step) : step(step > 0 ? step : 1e-9) {}
+
+void SegmentSet::add(const Point &a, const Point &b, std::vector<std::pair<double, double>> &uncovered)
+{
+    uncovered.clear();
+
+    double ax = std::round(a.x / step), ay = std::round(a.y / step), bx = std::round(b.x / step),
+            by = std::round(b.y / step);
+    if (std::max({std::abs(ax), std::abs(ay), std::abs(bx), std::abs(by)}) > MAX_GRID_COORDINATE)
+    {
+        uncovered.emplace_back(0, 1);
+        return;
+    }
+
+    auto x0 = static_cast<int64_t>(ax), y0 = static_cast<int64_t>(ay), x1 = static_cast<int64_t>(bx),
+            y1 = static_cast<int64_t>(by);
+    if (x0 == x1 && y0 == y1)
+    {
+        // Rounding would make it a point that any other segment seems to cover, so only an exact retrace does.
+        std::array<double, 4> ends = a.x < b.x || (a.x == b.x && a.y < b.y) ? std::array<double, 4>{a.x, a.y, b.x, b.y}
+                                                                           : std::array<double, 4>{b.x, b.y, a.x, a.y};
+        if (shortSegments.insert(ends).second) uncovered.emplace_back(0, 1);
+        return;
+    }
+
+    // Smallest step along the line, pointing right (or up), and the position of both ends along it.
+    int64_t dx = x1 - x0, dy = y1 - y0, divisor = std::gcd(dx, dy);
+    dx /= divisor;
+    dy /= divisor;
+    if (dx < 0 || (dx == 0 && dy < 0))
+    {
+        dx = -dx;
+        dy = -dy;
+    }
+
+    Line line = {dx, dy, dx * y0 - dy * x0};
+    int64_t from = dx * x0 + dy * y0, to = dx * x1 + dy * y1;
+    int64_t low = std::min(from, to), high = std::max(from, to);
+
+    std::vector<std::pair<int64_t, int64_t>> &covered = lines[line];
+    std::vector<std::pair<int64_t, int64_t>> gaps;
+    int64_t cursor = low;
+
+    for (const auto &[start, end]: covered)
+    {
+        if (end <= cursor || start >= high) continue;
+        if (start > cursor) gaps.emplace_back(cursor, start);
+        cursor = std::max(cursor, end);
+    }
+    if (cursor < high) gaps.emplace_back(cursor, high);
+
+    // Merge the new interval into the covered ones, which stay sorted and disjoint.
+    std::vector<std::pair<int64_t, int64_t>> merged;
+    merged.reserve(covered.size() + 1);
+    bool isInserted = false;
+
+    for (const auto &interval: covered)
+    {
+        if (interval.second < low)
+        {
+            merged.push_back(interval);
+            continue;
+        }
+        if (interval.first > high)
+        {
+            if (!isInserted) merged.emplace_back(low, high);
+            isInserted = true;
+            merged.push_back(interval);
+            continue;
+        }
+
+        low = std::min(low, interval.first);
+        high = std::max(high, interval.second);
+    }
+    if (!isInserted) merged.emplace_back(low, high);
+    covered = std::move(merged);
+
+    // Back to fractions along the segment as it was given.
+    double length = static_cast<double>(to - from);
+    for (const auto &[start, end]: gaps)
+    {
+        double u0 = static_cast<double>(start - from) / length, u1 = static_cast<double>(end - from) / length;
+        if (u0 > u1) std::swap(u0, u1);
+
+        uncovered.emplace_back(u0, u1);
+    }
+
+    if (to < from) std::reverse(uncovered.begin(), uncovered.end());
+}
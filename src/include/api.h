@@ -1,60 +1,71 @@
 #pragma once
 
+#include <chrono>
 #include <string>
 #include <locale>
 #include <codecvt>
 
 #include <boost/python.hpp>
 
+#include "plotter.h"
 #include "utils.h"
 
-class AxiDraw
+// Plotter backed by pyaxidraw, through boost::python. Creating one starts the Python interpreter.
+//
+// Every call into Python costs far more than the work it asks for, so each command makes at most one: the methods of
+// the AxiDraw object are looked up once, and a whole DRAW path runs through a small helper on the Python side. The pen
+// state and the position are kept on the C++ side from the commands sent, clamped to the travel envelope like
+// pyaxidraw does, so pen commands that would not change anything, GETPEN and GETPOS make none; they are read back from
+// pyaxidraw only on connect and on SYNC. --stats reports how many calls were made.
+class AxiDraw : public Plotter
 {
 public:
     AxiDraw();
+    ~AxiDraw() override;
 
 #pragma region General
-    void setAcceleration(double);
+    void setAcceleration(double) override;
 
-    void setPenUpPosition(double);
-    void setPenDownPosition(double);
+    void setPenUpPosition(double) override;
+    void setPenDownPosition(double) override;
 
-    void setPenUpDelay(double);
-    void setPenDownDelay(double);
+    void setPenUpDelay(double) override;
+    void setPenDownDelay(double) override;
 
-    void setPenUpSpeed(double);
-    void setPenDownSpeed(double);
+    void setPenUpSpeed(double) override;
+    void setPenDownSpeed(double) override;
 
-    void setPenUpRate(double);
-    void setPenDownRate(double);
+    void setPenUpRate(double) override;
+    void setPenDownRate(double) override;
 
-    void setModel(int);
-    void setPort(const std::string &);
+    void setModel(int) override;
+    void setPort(const std::string &) override;
 
-    std::string getMode();
+    std::string getMode() override;
 #pragma endregion
 
 #pragma region Interactive
-    void modeInteractive();
-    void setUnits(int);
+    void modeInteractive() override;
+    void setUnits(int) override;
 
-    void connect();
-    void disconnect();
-    void updateOptions();
+    void connect() override;
+    void disconnect() override;
+    void updateOptions() override;
 
-    void penUp();
-    void penDown();
-    void penToggle();
+    void penUp() override;
+    void penDown() override;
+    void penToggle() override;
 
-    void home();
-    void goTo(double, double);
-    void goToRelative(double, double);
+    void home() override;
+    void goTo(double, double) override;
+    void goToRelative(double, double) override;
 
-    void draw(std::vector<std::pair<double, double>>);
-    void wait(double);
+    void draw(const Point *, size_t) override;
+    void wait(double) override;
 
-    std::pair<double, double> getPosition();
-    bool getPen();
+    std::pair<double, double> getPosition() override;
+    bool getPen() override;
+    void sync() override;
 
     /* TODO: Add support for the following commands:
     +--------------+----------------------------------------------------+
@@ -67,8 +78,8 @@ public:
 #pragma endregion
 
 #pragma region Plot
-    void modePlot(const std::string &);
-    void runPlot();
+    void modePlot(const std::string &) override;
+    void runPlot() override;
 
     /* TODO: Add support for the following commands:
     +--------------+----------------------------------------------------+
@@ -93,26 +104,26 @@ public:
     */
 #pragma endregion
 
-    #pragma region Enums
-    enum Units
-    {
-        Inches = 0,
-        Centimeters = 1,
-        Millimeters = 2,
-    };
-
-    enum Models
-    {
-        V2_V3_SEA4 = 1,
-        V3A3_SEA3 = 2,
-        V3_XLX = 3,
-        MiniKit = 4,
-        SEA1 = 5,
-        SEA2 = 6,
-        V3B6 = 7,
-    };
-#pragma endregion
-
 private:
-    boost::python::object axiDraw;
+    boost::python::object axiDraw, options;
+    // Methods of axiDraw and the helpers in api.cpp, looked up once.
+    struct
+    {
+        boost::python::object moveTo, move, delay, penUp, penDown, drawPath, readState;
+    } methods;
+
+    // Model and units as set by the program, and as they were when connect() or updateOptions() last applied them.
+    Settings pending, active;
+    bool isPenUp;
+    // Carriage position in inches, so that it stays put when the units change.
+    Point position;
+
+    size_t crossings;
+    std::chrono::steady_clock::time_point created;
+    std::chrono::steady_clock::duration pythonTime;
+
+    template<typename... Arguments>
+    boost::python::object call(const boost::python::object &, const Arguments &...);
+    void setOption(const char *, const boost::python::object &);
+    void moveTo(const Point &);
 };
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "program.h"
+#include "utils.h"
+
+// A program saved by "--compile". The file is the header below followed by the instruction, point, option and string
+// arrays of the Program, each padded to 8 bytes, in the same layout they have in memory. Opening one maps the file and
+// checks it once, after which the executor runs straight out of the mapping.
+struct CompiledHeader
+{
+    char magic[4];
+    uint32_t version;
+
+    // Hash and size of the script the program was compiled from, to tell whether it is still up to date. The hash also
+    // covers the optimization settings the program was compiled with.
+    uint64_t sourceHash, sourceSize;
+
+    uint64_t instructionCount, pointCount, optionCount, stringSize;
+    // hashBytes() of everything after the header.
+    uint64_t checksum;
+};
+
+class CompiledProgram
+{
+public:
+    static constexpr char MAGIC[4] = {'A', 'X', 'C', '\0'};
+    // Bump whenever Instruction, Option, Point or the token list change layout or meaning.
+    static constexpr uint32_t VERSION = 3;
+
+    static bool isCompiled(const std::string &);
+    static std::string defaultPath(const std::string &);
+    static void write(const std::string &, const ProgramView &, uint64_t, uint64_t);
+
+    // Maps and validates a compiled file. On failure, returns false and sets the reason.
+    bool open(const std::string &, std::string &);
+
+    [[nodiscard]] bool matches(uint64_t, uint64_t) const;
+    [[nodiscard]] ProgramView view() const;
+
+private:
+    boost::iostreams::mapped_file_source mapping;
+    ProgramView program = {};
+    const CompiledHeader *header = nullptr;
+};
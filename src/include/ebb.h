@@ -0,0 +1,168 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/serial_port.hpp>
+#include <boost/asio/streambuf.hpp>
+
+#include "model.h"
+#include "planner.h"
+#include "plotter.h"
+#include "program.h"
+#include "stepper.h"
+#include "utils.h"
+
+// Serial link to the EiBotBoard (EBB) that drives the AxiDraw. Commands are single lines ending in "\r"; the board
+// answers "OK", or a line of data followed by "OK" for queries, or a line starting with "!" on errors. See
+// https://evil-mad.github.io/EggBot/ebb.html for the command set.
+//
+// Commands are pipelined: command() returns as soon as the line is written, and the replies are matched to the
+// commands in flight as they arrive. The board only acknowledges a motion command once it has room for it in its
+// motion FIFO, so keeping a few commands in flight means the next move is always parsed and waiting when the current
+// one ends, instead of a USB round trip later. The number in flight starts small and grows whenever a "QM" status
+// poll finds that the board ran out of motion while commands were still on their way.
+//
+// command() only queues the line: a writer thread streams the queue to the board, so the caller can plan and compile
+// the next path while the board is still being fed the previous one. Queries and flush() wait for the queue first.
+class EbbConnection
+{
+public:
+    EbbConnection();
+    ~EbbConnection();
+
+    // Opens the given serial device, or the first EiBotBoard found if it is empty. Returns false if nothing answers.
+    bool open(const std::string &);
+    // Waits for the commands still in flight, then closes the port.
+    void close();
+    [[nodiscard]] bool isOpen() const;
+    [[nodiscard]] const std::string &getVersion() const;
+
+    // Queues a command to be sent without waiting for its "OK". Only waits if the queue is full. Motion commands pass
+    // their duration, which tells how long the board may take to acknowledge the commands after them.
+    void command(const std::string &, double = 0);
+    // Waits until every command sent so far has been acknowledged.
+    void flush();
+    // Sends a query and returns the first line of the reply, consuming the "OK" after it if the query has one.
+    std::string query(const std::string &, bool = true);
+
+private:
+    struct Pending
+    {
+        std::string line;
+        bool isQuery, endsWithOk, hasReply;
+    };
+
+    boost::asio::io_context io;
+    boost::asio::serial_port port;
+    boost::asio::streambuf buffer;
+    std::string device, version;
+
+    std::deque<Pending> inFlight;
+    std::string lastReply;
+    boost::system::error_code readError;
+    bool isReading;
+
+    // Commands allowed in flight, and how many times the board was found idle with commands still on their way.
+    size_t window, underruns, sent;
+    // When the motion queued so far will be done, and when the board's queue was last polled.
+    std::chrono::steady_clock::time_point queuedUntil, lastPoll;
+
+    // Commands waiting for the writer, with their durations. The writer is busy while it is sending one of them.
+    std::deque<std::pair<std::string, double>> queue;
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    bool isWriting, isStopping;
+    std::thread writer;
+
+    bool tryOpen(const std::string &);
+    void stream();
+    void transmit(const std::string &, double);
+    void drain();
+    void send(const std::string &, bool, bool);
+    void startReading();
+    void receive(const std::string &);
+    void waitForReply();
+};
+
+// Plotter that sends EBB commands itself, without Python. It supports interactive mode; plotting SVG files still
+// needs pyaxidraw. The carriage is assumed to be at the home position on connect, like pyaxidraw does.
+class EbbPlotter : public Plotter
+{
+public:
+    EbbPlotter();
+
+#pragma region General
+    void setAcceleration(double) override;
+
+    void setPenUpPosition(double) override;
+    void setPenDownPosition(double) override;
+
+    void setPenUpDelay(double) override;
+    void setPenDownDelay(double) override;
+
+    void setPenUpSpeed(double) override;
+    void setPenDownSpeed(double) override;
+
+    void setPenUpRate(double) override;
+    void setPenDownRate(double) override;
+
+    void setModel(int) override;
+    void setPort(const std::string &) override;
+
+    std::string getMode() override;
+#pragma endregion
+
+#pragma region Interactive
+    void modeInteractive() override;
+    void setUnits(int) override;
+
+    void connect() override;
+    void disconnect() override;
+    void updateOptions() override;
+
+    void penUp() override;
+    void penDown() override;
+    void penToggle() override;
+
+    void home() override;
+    void goTo(double, double) override;
+    void goToRelative(double, double) override;
+
+    void draw(const Point *, size_t) override;
+    void wait(double) override;
+
+    std::pair<double, double> getPosition() override;
+    bool getPen() override;
+    void sync() override;
+#pragma endregion
+
+#pragma region Plot
+    void modePlot(const std::string &) override;
+    void runPlot() override;
+#pragma endregion
+
+private:
+    // Options as set by the program, and as they were when connect() or updateOptions() last applied them.
+    Settings pending, active;
+    bool isInteractive, isPenUp;
+    // Path being planned, in inches, and the packets it compiles to.
+    std::vector<Point> waypoints;
+    std::vector<StepPacket> packets;
+    StepCompiler stepper;
+
+    EbbConnection connection;
+
+    void requireConnection(const char *) const;
+    void configureServo();
+    void setPen(bool);
+    void moveTo(const Point *, size_t, bool);
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <string>
+
+#include "utils.h"
+
+// Pretends to be an EiBotBoard on a pseudo-terminal, so that the ebb backend can be run, tested and timed without an
+// AxiDraw. Point PORT (or --backend ebb's auto-detection, which does not look at ptys) at the device it prints.
+//
+// Every line takes the given latency to get to the board and back, half each way, like a USB round trip; commands
+// still in transit do not hold up the ones being answered, so pipelining pays off as it does on the real board.
+// Motion commands (SM, SP with a duration) go through a motion FIFO of the given depth behind the move being executed,
+// and like on the board, a motion command is only answered once there is room for it, in real time. The resulting
+// motion is written to the log file as CSV, with the motor positions in steps and X and Y in inches, and a summary is
+// printed whenever the plotter disconnects.
+class EbbEmulator
+{
+public:
+    EbbEmulator(double, size_t, const std::string & = "");
+    ~EbbEmulator();
+
+    // Serves connections until interrupted.
+    void run();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Line
+    {
+        Clock::time_point due;
+        std::string text;
+    };
+
+    Clock::duration latency;
+    size_t fifoDepth;
+    std::ofstream log;
+    int master;
+
+    std::string received;
+    std::deque<Line> inbox, outbox;
+    // When each move in the FIFO ends, the one being executed first.
+    std::deque<Clock::time_point> moves;
+
+    // State of the current session.
+    bool isConnected, isPenUp;
+    int64_t motor1, motor2;
+    size_t commands, motionCommands;
+    Clock::time_point start, lastMoveEnd;
+    Clock::duration motionTime, idleTime;
+
+    void openTerminal();
+    void resetSession();
+    void printSummary() const;
+
+    void readInput(Clock::time_point);
+    void writeOutput(Clock::time_point);
+    bool processCommand(Clock::time_point);
+    std::string answer(const std::string &, Clock::time_point);
+    void queueMove(double, Clock::time_point);
+};
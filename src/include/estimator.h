@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include "geometry.h"
+#include "model.h"
+#include "planner.h"
+#include "program.h"
+#include "utils.h"
+
+struct Estimate
+{
+    double seconds = 0;
+    // In inches.
+    double penDownDistance = 0, penUpDistance = 0;
+    size_t penLifts = 0;
+
+    Estimate &operator+=(const Estimate &other)
+    {
+        seconds += other.seconds;
+        penDownDistance += other.penDownDistance;
+        penUpDistance += other.penUpDistance;
+        penLifts += other.penLifts;
+
+        return *this;
+    }
+};
+
+// Run time of a program on the plotter, for --estimate and to tell how much an optimization saves. Moves follow the
+// speed profiles of the MotionPlanner: each one speeds up to the pen-up or pen-down speed and slows down again, but
+// only as much as the corners between the segments of a DRAW path need. Pen moves use the servo timing of
+// pyaxidraw. Moves are limited to the travel envelope of the MODEL, like pyaxidraw does. Everything follows the options
+// set in the program, or pyaxidraw's defaults. The pen starts up at the home position.
+class Estimator
+{
+public:
+    Estimator();
+    // If a map is given, the estimate is also broken down by the source line of each instruction.
+    Estimate estimate(const ProgramView &, std::map<uint32_t, Estimate> * = nullptr);
+
+private:
+    // Current value of each option, indexed by its token type.
+    double settings[Token::typeCount];
+    bool isPenUp;
+    // In inches.
+    Point position;
+    std::vector<Point> path;
+
+    void reset();
+    Point toInches(const Point &) const;
+    void travel(Estimate &, const Point *, size_t, bool);
+    void movePen(Estimate &, bool);
+};
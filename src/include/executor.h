@@ -0,0 +1,28 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <regex>
+
+#include <boost/filesystem.hpp>
+#include <curl/curl.h>
+
+#include "plotter.h"
+#include "program.h"
+#include "utils.h"
+
+// Runs a program produced by the Parser, or loaded from a compiled file, on the AxiDraw through the given backend
+// (see Plotter). Everything here was already validated, so the only errors left to report are the ones coming from the
+// device itself.
+class Executor
+{
+public:
+    explicit Executor(const std::string & = "pyaxidraw");
+    void run(const ProgramView &);
+
+private:
+    std::unique_ptr<Plotter> plotter;
+
+    void setOption(const ProgramView &, const Option &);
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+struct Rect
+{
+    double minX, minY, maxX, maxY;
+
+    [[nodiscard]] bool contains(const Point &point) const
+    {
+        return point.x >= minX && point.x <= maxX && point.y >= minY && point.y <= maxY;
+    }
+
+    [[nodiscard]] Point clamp(const Point &point) const
+    {
+        return {std::clamp(point.x, minX, maxX), std::clamp(point.y, minY, maxY)};
+    }
+};
+
+inline double distanceSquared(const Point &a, const Point &b)
+{
+    return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+}
+
+inline double distance(const Point &a, const Point &b)
+{
+    return std::sqrt(distanceSquared(a, b));
+}
+
+inline double distanceToSegmentSquared(const Point &point, const Point &a, const Point &b)
+{
+    double dx = b.x - a.x, dy = b.y - a.y, length = dx * dx + dy * dy;
+    if (length == 0) return distanceSquared(point, a);
+
+    double t = std::clamp(((point.x - a.x) * dx + (point.y - a.y) * dy) / length, 0.0, 1.0);
+    return distanceSquared(point, {a.x + t * dx, a.y + t * dy});
+}
+
+// Liang-Barsky clipping of the count - 1 segments of a polyline: segment i is visible from enter[i] to exit[i] (as
+// fractions from point i to point i + 1), or not at all if enter[i] > exit[i]. There are no branches in the loop, so
+// that the compiler can vectorize it over batches of segments.
+void clipSegments(const Point *, size_t, const Rect &, double *, double *);
+
+// Marks which points of a polyline to keep so that the result stays within the tolerance of the original: the first
+// and last points, and whatever Ramer-Douglas-Peucker keeps after repeated and collinear points have been merged.
+void simplifyPolyline(const Point *, size_t, double, uint8_t *);
+
+// Uniform grid over a fixed set of points, for nearest-neighbour and radius queries. Points are identified by their
+// index in the vector the grid was built from, and can be removed in constant time. The grid shrinks itself as points
+// are removed so that searches stay local when only a few are left.
+class PointGrid
+{
+public:
+    explicit PointGrid(const std::vector<Point> &);
+
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] bool contains(uint32_t) const;
+    void remove(uint32_t);
+
+    // Closest remaining point, or false if there are none left.
+    bool nearest(const Point &, uint32_t &);
+
+    // Calls the function with the id of every remaining point within the radius, in no particular order. Points must
+    // not be removed from inside the callback.
+    template<typename Function>
+    void forEachWithin(const Point &center, double radius, const Function &function) const
+    {
+        if (live == 0) return;
+
+        int64_t fromX, fromY, toX, toY;
+        cellOf({center.x - radius, center.y - radius}, fromX, fromY);
+        cellOf({center.x + radius, center.y + radius}, toX, toY);
+
+        for (int64_t y = fromY; y <= toY; y++)
+            for (int64_t x = fromX; x <= toX; x++)
+            {
+                size_t cell = static_cast<size_t>(y) * columns + static_cast<size_t>(x);
+                for (uint32_t i = cellStart[cell]; i < cellStart[cell] + cellCount[cell]; i++)
+                    if (distanceSquared(points[ids[i]], center) <= radius * radius) function(ids[i]);
+            }
+    }
+
+private:
+    const std::vector<Point> &points;
+
+    Point origin;
+    double cellSize;
+    size_t columns, rows;
+
+    // Cells are contiguous slices of ids; the first cellCount entries of a slice are the points still in it.
+    std::vector<uint32_t> cellStart, cellCount, ids;
+    // Position of each point in ids, or UINT32_MAX once removed.
+    std::vector<uint32_t> slots;
+    size_t live, builtWith;
+
+    void build();
+    void cellOf(const Point &, int64_t &, int64_t &) const;
+};
+
+// Everything drawn so far, as covered intervals on lines. Endpoints are rounded to a grid first, so that segments on
+// the same line always get exactly the same key (the reduced direction and offset of the line in grid steps) whatever
+// their length or direction, and overlaps are found with integer arithmetic.
+class SegmentSet
+{
+public:
+    explicit SegmentSet(double);
+
+    // Adds a segment and returns the parts of it that were not already covered, as fractions of the way from the
+    // first point to the second, in order. Segments too far from the origin for the grid are always fully returned,
+    // and so are segments shorter than a grid step, unless the very same segment was added before.
+    void add(const Point &, const Point &, std::vector<std::pair<double, double>> &);
+
+private:
+    struct Line
+    {
+        int64_t dx, dy, offset;
+
+        bool operator==(const Line &other) const
+        {
+            return dx == other.dx && dy == other.dy && offset == other.offset;
+        }
+    };
+
+    struct LineHash
+    {
+        size_t operator()(const Line &line) const
+        {
+            uint64_t hash = static_cast<uint64_t>(line.dx) * 0x9e3779b97f4a7c15;
+            hash = (hash ^ static_cast<uint64_t>(line.dy)) * 0xbf58476d1ce4e5b9;
+            return (hash ^ static_cast<uint64_t>(line.offset)) * 0x94d049bb133111eb;
+        }
+    };
+
+    double step;
+    // Disjoint covered intervals on each line, in grid steps along its direction.
+    std::unordered_map<Line, std::vector<std::pair<int64_t, int64_t>>, LineHash> lines;
+    // Segments whose ends round to the same grid point, which have no line; their ends in order, as given.
+    std::set<std::array<double, 4>> shortSegments;
+};
@@ -5,6 +5,7 @@
 #include <vector>
 #include <csignal>
 
+#include "executor.h"
 #include "lexer.h"
 #include "parser.h"
 #include "utils.h"
@@ -14,7 +15,7 @@ constexpr std::string_view PROMPT = "\033[1;32mAxiLang\033[0m>> ";
 class Interpreter
 {
 public:
-    Interpreter();
+    explicit Interpreter(const std::string & = "pyaxidraw");
     void run();
 private:
     std::string input;
@@ -23,6 +24,7 @@ private:
     Lexer lexer;
     FileState fileState;
     Parser parser;
+    Executor executor;
 
     void printHistory();
     void clearHistory();
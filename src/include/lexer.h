@@ -1,12 +1,16 @@
 #pragma once
 
-#include <fstream>
+#include <charconv>
 #include <string>
-#include <cassert>
+#include <string_view>
+#include <cstdint>
 #include <sstream>
 
 #include <boost/filesystem.hpp>
 
+#include "parallel.h"
+#include "scanner.h"
+#include "source.h"
 #include "utils.h"
 
 class Lexer
@@ -14,21 +18,27 @@ class Lexer
 public:
     explicit Lexer(const std::string &);
     Lexer();
-    ~Lexer();
 
-    Token nextToken(bool = false);
+    Token nextToken();
+    std::vector<Token> lexAll(unsigned = 1);
     std::vector<Token> lexInput(const std::string &);
 
-    int getLineNumber() const;
-    int getLinePosition() const;
-    std::string getLine() const;
+    std::shared_ptr<const Source> getSource() const;
 
 private:
-    std::ifstream file;
-    std::string line;
+    // Lexes [begin, end) of an existing source without reporting unknown tokens, for parallel lexing.
+    Lexer(std::shared_ptr<const Source>, size_t, size_t);
 
-    int lineNum;
-    int linePos;
+    std::shared_ptr<const Source> source;
+    std::string_view text;
+    Scanner scanner;
+    size_t pos, end;
 
-    static Token::Type getTokenType(const std::string &);
+    bool reportsUnknown = true;
+    bool endsInComment = false;
+
+    void reset(std::shared_ptr<const Source>);
+    void reportUnknownToken(const Token &) const;
+    static Token::Type getTokenType(std::string_view);
+    static bool parseNumber(std::string_view, double &);
 };
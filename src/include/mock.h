@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "geometry.h"
+#include "model.h"
+#include "planner.h"
+#include "plotter.h"
+#include "utils.h"
+
+// Plotter that does without an AxiDraw, Python or pyaxidraw, for running and timing programs anywhere. It keeps track
+// of the pen and the position, clamped to the travel envelope, so that GETPOS and GETPEN answer like on the AxiDraw.
+//
+// As the "null" backend it does nothing else. As the "mock" backend it also records every call, with the time it would
+// start at on an AxiDraw and how long it would take there, from the motion planner and the servo timing, as if each
+// call started as soon as the one before it ended. The recording is shown with --debug; a summary of how fast the
+// calls came in is printed at the end.
+class MockPlotter : public Plotter
+{
+public:
+    explicit MockPlotter(bool = false);
+    ~MockPlotter() override;
+
+#pragma region General
+    void setAcceleration(double) override;
+
+    void setPenUpPosition(double) override;
+    void setPenDownPosition(double) override;
+
+    void setPenUpDelay(double) override;
+    void setPenDownDelay(double) override;
+
+    void setPenUpSpeed(double) override;
+    void setPenDownSpeed(double) override;
+
+    void setPenUpRate(double) override;
+    void setPenDownRate(double) override;
+
+    void setModel(int) override;
+    void setPort(const std::string &) override;
+
+    std::string getMode() override;
+#pragma endregion
+
+#pragma region Interactive
+    void modeInteractive() override;
+    void setUnits(int) override;
+
+    void connect() override;
+    void disconnect() override;
+    void updateOptions() override;
+
+    void penUp() override;
+    void penDown() override;
+    void penToggle() override;
+
+    void home() override;
+    void goTo(double, double) override;
+    void goToRelative(double, double) override;
+
+    void draw(const Point *, size_t) override;
+    void wait(double) override;
+
+    std::pair<double, double> getPosition() override;
+    bool getPen() override;
+    void sync() override;
+#pragma endregion
+
+#pragma region Plot
+    void modePlot(const std::string &) override;
+    void runPlot() override;
+#pragma endregion
+
+private:
+    bool isRecording, isInteractive, isPenUp;
+    // Options as set by the program, and as they were when connect() or updateOptions() last applied them.
+    Settings pending, active;
+    // Carriage position in inches.
+    Point position;
+
+    // Time on the AxiDraw when the last call ended, in seconds, and how many calls were recorded.
+    double time;
+    size_t calls;
+    std::vector<Point> waypoints;
+    std::chrono::steady_clock::time_point created;
+
+    void record(const char *, const std::vector<double> & = {}, double = 0, const std::string & = "");
+    double setPen(bool);
+    double moveTo(const Point *, size_t, bool);
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+// Hardware limits of each AxiDraw model, indexed by the MODEL option (Plotter::Models); index 0 is unused.
+struct ModelSpec
+{
+    const char *name;
+    // Travel envelope, in inches, from the home position (top left) to the right and down.
+    double width, height;
+};
+
+inline constexpr ModelSpec MODEL_SPECS[] = {
+        {"",                               0,     0},
+        {"AxiDraw V2, V3 or SE/A4",        11.81, 8.58},
+        {"AxiDraw V3/A3 or SE/A3",         16.93, 11.69},
+        {"AxiDraw V3 XLX",                 23.42, 8.58},
+        {"AxiDraw MiniKit",                6.30,  4.00},
+        {"AxiDraw SE/A1",                  34.02, 23.39},
+        {"AxiDraw SE/A2",                  23.39, 17.01},
+        {"AxiDraw V3/B6",                  7.48,  5.51},
+};
+
+inline constexpr size_t MODEL_COUNT = sizeof(MODEL_SPECS) / sizeof(MODEL_SPECS[0]);
+
+// Maximum XY speed at 100%, in inches per second, for the default (high) motor resolution. The same for every model.
+inline constexpr double MAX_SPEED = 8.6869;
+// Acceleration at an ACCEL of 100%, in inches per second squared. pyaxidraw accelerates faster with the pen up.
+inline constexpr double PEN_DOWN_ACCELERATION = 40;
+inline constexpr double PEN_UP_ACCELERATION = 60;
+
+// Servo timing: a full 0 - 100% sweep takes SERVO_SWEEP_MS at a 100% pen rate, and no pen move takes less than
+// SERVO_MOVE_MIN_MS + SERVO_MOVE_SLOPE_MS per percent of travel.
+inline constexpr double SERVO_SWEEP_MS = 200;
+inline constexpr double SERVO_MOVE_MIN_MS = 45;
+inline constexpr double SERVO_MOVE_SLOPE_MS = 2.69;
+
+// Time for the pen to travel the given percentage of its range at the given pen rate, in milliseconds.
+inline double servoMoveTime(double travel, double rate)
+{
+    return std::max(SERVO_SWEEP_MS * travel / std::max(rate, 1.0), SERVO_MOVE_MIN_MS + SERVO_MOVE_SLOPE_MS * travel);
+}
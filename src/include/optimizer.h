@@ -0,0 +1,94 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "estimator.h"
+#include "geometry.h"
+#include "model.h"
+#include "parallel.h"
+#include "program.h"
+#include "utils.h"
+
+// A DRAW path as a range of points, which may be drawn backwards.
+struct Polyline
+{
+    uint32_t first, count, line;
+    bool isReversed;
+
+    [[nodiscard]] const Point &start(const std::vector<Point> &points) const
+    {
+        return points[isReversed ? first + count - 1 : first];
+    }
+
+    [[nodiscard]] const Point &end(const std::vector<Point> &points) const
+    {
+        return points[isReversed ? first : first + count - 1];
+    }
+
+    // The i-th point in drawing order.
+    [[nodiscard]] const Point &at(const std::vector<Point> &points, uint32_t i) const
+    {
+        return points[isReversed ? first + count - 1 - i : first + i];
+    }
+};
+
+// A stretch of DRAW, GOTO and PENUP commands, split into what may be rearranged and what may not. The paths can be
+// drawn in any order and direction without the rest of the script noticing, as long as the run starts from `start`,
+// then finishes with the pinned path and the final move (when there are any). Only the last path of a run is pinned,
+// and only when a command after the run could see where it left the pen.
+struct Run
+{
+    Point start;
+    std::vector<Polyline> paths;
+    std::optional<Polyline> pinned;
+    std::optional<Instruction> end;
+    std::optional<Instruction> penUp;
+};
+
+// Passes that rewrite a parsed program into one that draws the same thing in less time. Each pass logs what it
+// changed. Passes only reorder or drop commands where nothing in the script could observe the difference.
+class Optimizer
+{
+public:
+    explicit Optimizer(Program &, unsigned = 1);
+
+    // Clips DRAW paths to the page rectangle (in the active UNITS) or, without one, to the travel envelope of the
+    // active MODEL, splitting paths where they leave and come back. GOTO targets outside are moved onto the border.
+    // Where a removed or shortened DRAW would have left the pen and the carriage is restored before the next command
+    // that depends on it (PENTOGGLE, GOTO_REL, GETPOS, GETPEN, SYNC).
+    void clip(const std::optional<Rect> &);
+
+    // Removes or merges redundant commands: repeated pen moves, moves to the current position or straight into
+    // another move, zero-length DRAW segments, empty WAITs and options that are set to the value they already have.
+    void peephole();
+    // Changes the order and direction of the paths in each run to cut down pen-up travel: a greedy nearest-neighbour
+    // tour, refined with 2-opt.
+    void reorder();
+    // Joins paths in each run whose ends are within the tolerance (in script units) of each other into single strokes,
+    // reversing paths where needed, so that the pen is not lifted between them.
+    void join(double);
+    // Starts each closed path (one that ends where it starts) at the vertex closest to where the pen is when it gets
+    // there, or at a random vertex so that the seams do not line up.
+    void rotateClosed(bool);
+    // Drops DRAW vertices that change the drawn path by less than the tolerance, in the units active at the DRAW.
+    void simplify(double);
+    // Removes the parts of DRAW segments that retrace something already drawn, exactly or along the same line, with
+    // coordinates rounded to the given grid. Paths are split where a removed part leaves a gap.
+    void dedupe(double);
+
+private:
+    Program &program;
+    unsigned threads;
+
+    // Splits the program into runs, lets the pass rearrange each of them, then puts the program back together. Paths
+    // may point at points the pass appended to program.points; unused points are dropped.
+    void rewriteRuns(const std::function<void(Run &)> &);
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+// Number of worker threads used by default: one per hardware thread.
+inline unsigned defaultThreadCount()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Runs task(i) for every i in [0, count) on a pool of up to `threads` workers and waits for all of them to finish.
+// With a single thread (or a single task) everything runs on the calling thread.
+template<typename Task>
+void parallelFor(size_t count, unsigned threads, const Task &task)
+{
+    if (threads <= 1 || count <= 1)
+    {
+        for (size_t i = 0; i < count; i++) task(i);
+        return;
+    }
+
+    boost::asio::thread_pool pool(std::min<size_t>(threads, count));
+    for (size_t i = 0; i < count; i++) boost::asio::post(pool, [&task, i] { task(i); });
+
+    pool.join();
+}
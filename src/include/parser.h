@@ -3,27 +3,41 @@
 #include <fstream>
 #include <string>
 #include <regex>
-
-#include "api.h"
-#include "utils.h"
+#include <utility>
 
 #include <boost/filesystem.hpp>
-#include <utility>
-#include <curl/curl.h>
 
+#include "program.h"
+#include "utils.h"
+
+// Validates a token stream and compiles it into a Program. Nothing is sent to the AxiDraw here; see Executor. The
+// parser keeps its state (mode, plot file) between calls, so the interpreter can feed it one line at a time.
 class Parser
 {
 public:
     explicit Parser(FileState fileState, bool shouldExitOnError = true)
-            : fileState(std::move(fileState)), axiDraw(), isModeSet(false), isModePlot(false),
-              shouldExitOnError(shouldExitOnError) {}
-    void parse();
+            : fileState(std::move(fileState)), index(0), lineNum(1), lineOffset(0), isModeSet(false), isModePlot(false),
+              hasPlotFile(false), shouldExitOnError(shouldExitOnError) {}
+    Program parse();
+    Program parse(FileState);
 
 private:
     FileState fileState;
-    AxiDraw axiDraw;
+    size_t index;
+    // Line of the command being parsed, and the offset it was counted up to.
+    uint32_t lineNum, lineOffset;
 
-    bool isModeSet, isModePlot, shouldExitOnError = true;
-    void checkInteractive(const std::string &);
-};
+    bool isModeSet, isModePlot, hasPlotFile, shouldExitOnError = true;
 
+    void error(const std::string &);
+    bool checkInteractive(const std::string &);
+    bool readNumber(double &);
+    uint32_t currentLine();
+
+    void parseMode(Program &);
+    void parseOptions(Program &, bool);
+    void parseMove(Program &, bool);
+    void parseDraw(Program &);
+    void parseWait(Program &);
+    void parseSetPlot(Program &);
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "geometry.h"
+#include "model.h"
+#include "utils.h"
+
+// Speed and acceleration of the carriage, in inches per second and inches per second squared.
+struct MotionLimits
+{
+    double speed, acceleration;
+};
+
+// Limits for a pen-up or pen-down move, from the speed and ACCEL options in percent, as pyaxidraw takes them.
+inline MotionLimits motionLimits(bool penDown, double speed, double acceleration)
+{
+    return {MAX_SPEED * std::clamp(speed, 1.0, 100.0) / 100,
+            (penDown ? PEN_DOWN_ACCELERATION : PEN_UP_ACCELERATION) * std::clamp(acceleration, 1.0, 100.0) / 100};
+}
+
+// One straight move of a planned path, in inches. The carriage accelerates from the entry speed up to the cruise speed,
+// holds it, then slows down to the exit speed, which is the entry speed of the next move.
+struct PlannedMove
+{
+    Point start, end;
+    double length, entrySpeed, cruiseSpeed, exitSpeed, acceleration;
+
+    [[nodiscard]] double accelerationTime() const
+    {
+        return (cruiseSpeed - entrySpeed) / acceleration;
+    }
+
+    [[nodiscard]] double decelerationTime() const
+    {
+        return (cruiseSpeed - exitSpeed) / acceleration;
+    }
+
+    [[nodiscard]] double cruiseTime() const
+    {
+        double ramps = (cruiseSpeed * cruiseSpeed - entrySpeed * entrySpeed) / (2 * acceleration) +
+                       (cruiseSpeed * cruiseSpeed - exitSpeed * exitSpeed) / (2 * acceleration);
+        return cruiseSpeed > 0 ? std::max(length - ramps, 0.0) / cruiseSpeed : 0;
+    }
+
+    [[nodiscard]] double duration() const
+    {
+        return accelerationTime() + cruiseTime() + decelerationTime();
+    }
+
+    // Distance covered after the given time since the start of the move.
+    [[nodiscard]] double distanceAt(double) const;
+};
+
+// Plans the speed along a path so that the carriage only slows down as much as each corner needs, instead of stopping
+// at every vertex. The speed through a vertex is limited by how sharply the path turns there (the "junction deviation"
+// rule: the speed at which going around a small arc tangent to both segments stays within the acceleration limit), and
+// then by how fast the carriage can speed up or slow down over the segments around it, looking ahead over the whole
+// path. Paths start and end at rest.
+class MotionPlanner
+{
+public:
+    explicit MotionPlanner(MotionLimits);
+
+    // Plans a path through the given points, in inches. Zero-length segments are dropped.
+    const std::vector<PlannedMove> &plan(const Point *, size_t);
+
+private:
+    MotionLimits limits;
+    std::vector<PlannedMove> moves;
+
+    [[nodiscard]] double junctionSpeed(const PlannedMove &, const PlannedMove &) const;
+};
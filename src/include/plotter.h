@@ -0,0 +1,106 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "utils.h"
+
+// The operations the executor needs from a plotter. Implemented by AxiDraw, which goes through pyaxidraw, by
+// EbbPlotter, which talks to the EiBotBoard of the AxiDraw directly, and by MockPlotter, which does without one.
+// Options follow pyaxidraw: the ones set before connecting take effect on connect, and later changes take effect on
+// updateOptions().
+class Plotter
+{
+public:
+    virtual ~Plotter() = default;
+
+    // Names accepted by create(), for --backend.
+    static constexpr const char *BACKENDS[] = {"pyaxidraw", "ebb", "null", "mock"};
+    static bool isBackend(const std::string &);
+    static std::unique_ptr<Plotter> create(const std::string &);
+
+#pragma region General
+    virtual void setAcceleration(double) = 0;
+
+    virtual void setPenUpPosition(double) = 0;
+    virtual void setPenDownPosition(double) = 0;
+
+    virtual void setPenUpDelay(double) = 0;
+    virtual void setPenDownDelay(double) = 0;
+
+    virtual void setPenUpSpeed(double) = 0;
+    virtual void setPenDownSpeed(double) = 0;
+
+    virtual void setPenUpRate(double) = 0;
+    virtual void setPenDownRate(double) = 0;
+
+    virtual void setModel(int) = 0;
+    virtual void setPort(const std::string &) = 0;
+
+    virtual std::string getMode() = 0;
+#pragma endregion
+
+#pragma region Interactive
+    virtual void modeInteractive() = 0;
+    virtual void setUnits(int) = 0;
+
+    virtual void connect() = 0;
+    virtual void disconnect() = 0;
+    virtual void updateOptions() = 0;
+
+    virtual void penUp() = 0;
+    virtual void penDown() = 0;
+    virtual void penToggle() = 0;
+
+    virtual void home() = 0;
+    virtual void goTo(double, double) = 0;
+    virtual void goToRelative(double, double) = 0;
+
+    virtual void draw(const Point *, size_t) = 0;
+    virtual void wait(double) = 0;
+
+    virtual std::pair<double, double> getPosition() = 0;
+    virtual bool getPen() = 0;
+    // Reads the pen state and the position back from the plotter, for when they may have changed behind its back.
+    virtual void sync() = 0;
+#pragma endregion
+
+#pragma region Plot
+    virtual void modePlot(const std::string &) = 0;
+    virtual void runPlot() = 0;
+#pragma endregion
+
+#pragma region Enums
+    enum Units
+    {
+        Inches = 0,
+        Centimeters = 1,
+        Millimeters = 2,
+    };
+
+    enum Models
+    {
+        V2_V3_SEA4 = 1,
+        V3A3_SEA3 = 2,
+        V3_XLX = 3,
+        MiniKit = 4,
+        SEA1 = 5,
+        SEA2 = 6,
+        V3B6 = 7,
+    };
+#pragma endregion
+
+protected:
+    // Options as the plotters that keep track of them see them, with pyaxidraw's defaults.
+    struct Settings
+    {
+        double acceleration = 75;
+        double penUpPosition = 60, penDownPosition = 30;
+        double penUpDelay = 0, penDownDelay = 0;
+        double penUpSpeed = 75, penDownSpeed = 25;
+        double penUpRate = 75, penDownRate = 50;
+        int model = Models::V2_V3_SEA4, units = Units::Inches;
+        std::string port;
+    };
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "model.h"
+#include "parallel.h"
+#include "program.h"
+#include "utils.h"
+
+// Draws what a program would put on paper into a PNG image, without Python or a plotter. The image covers the travel
+// envelope of the largest MODEL used, with the home position at the top left. Pen-down strokes are drawn in ink and,
+// if asked for, pen-up travel as thin red lines under them. The canvas is split into square tiles; every segment is
+// sorted into the tiles its bounding box touches, and the tiles are then rendered independently on a thread pool.
+class Preview
+{
+public:
+    explicit Preview(double dpi = 96, bool showsTravel = false, unsigned threads = 1);
+    void render(const ProgramView &, const std::string &);
+
+private:
+    // In pixels.
+    struct Segment
+    {
+        float x0, y0, x1, y1;
+        bool isTravel;
+    };
+
+    double dpi;
+    bool showsTravel;
+    unsigned threads;
+
+    std::vector<Segment> segments;
+    size_t width, height;
+
+    void collect(const ProgramView &);
+    void renderTile(size_t, size_t, const uint32_t *, size_t, std::vector<uint8_t> &) const;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "utils.h"
+
+// Size of one inch in each of Plotter::Units (inches, centimeters, millimeters).
+inline constexpr double UNITS_PER_INCH[] = {1.0, 2.54, 25.4};
+
+// A validated script, as built by the parser and run by the executor. HOME and GOTO become absolute moves; GOTO_REL
+// stays relative, since only the plotter knows where clamping and reconnecting left the carriage. Variable-length
+// operands (the points of a polyline, the options of an option set, the path of a plot job) live in flat arrays of the
+// program that instructions refer to by range.
+struct Option
+{
+    // One of the option tokens, from Acceleration to Units.
+    Token::Type name;
+    double value;
+
+    // PORT only: range in Program::strings.
+    uint32_t first, count;
+};
+
+struct Instruction
+{
+    enum class Op : uint8_t
+    {
+        InteractiveMode,
+        PlotMode,
+        Options,       // first/count: range in Program::options
+        UpdateOptions, // first/count: range in Program::options
+        Connect,
+        Disconnect,
+        PenUp,
+        PenDown,
+        PenToggle,
+        Move,          // x/y: absolute target, pen up
+        MoveRelative,  // x/y: offset from wherever the plotter is, pen up
+        Draw,          // first/count: range in Program::points
+        Wait,          // x: milliseconds
+        GetPos,
+        GetPen,
+        Sync,
+        SetPlot,       // first/count: range in Program::strings
+        Plot,
+    };
+
+    Op op;
+    uint32_t line;
+    uint32_t first, count;
+    double x, y;
+
+    [[nodiscard]] const char *opToCStr() const
+    {
+        static constexpr const char *names[] = {"InteractiveMode", "PlotMode", "Options", "UpdateOptions", "Connect",
+                                                "Disconnect", "PenUp", "PenDown", "PenToggle", "Move", "MoveRelative",
+                                                "Draw", "Wait", "GetPos", "GetPen", "Sync", "SetPlot", "Plot"};
+        return names[static_cast<size_t>(op)];
+    }
+};
+
+// Read-only view of a program, which may live in a Program or in a mapped compiled file (see CompiledProgram).
+struct ProgramView
+{
+    const Instruction *instructions;
+    size_t instructionCount;
+    const Point *points;
+    size_t pointCount;
+    const Option *options;
+    size_t optionCount;
+    std::string_view strings;
+
+    [[nodiscard]] std::string_view text(uint32_t first, uint32_t count) const
+    {
+        return strings.substr(first, count);
+    }
+};
+
+struct Program
+{
+    std::vector<Instruction> instructions;
+    std::vector<Point> points;
+    std::vector<Option> options;
+    std::string strings;
+
+    Instruction &add(Instruction::Op op, uint32_t line)
+    {
+        instructions.push_back({op, line, 0, 0, 0, 0});
+        return instructions.back();
+    }
+
+    [[nodiscard]] std::string_view text(uint32_t first, uint32_t count) const
+    {
+        return std::string_view(strings).substr(first, count);
+    }
+
+    [[nodiscard]] ProgramView view() const
+    {
+        return {instructions.data(), instructions.size(), points.data(), points.size(), options.data(), options.size(),
+                strings};
+    }
+};
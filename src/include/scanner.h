@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Byte classification for the lexer. The buffer is classified 64 bytes at a time into a whitespace bitmask, so
+// finding where a word or a run of whitespace ends is a bit scan instead of a loop over bytes. The classification
+// kernel has a scalar version and, on x86, SSE2 and AVX2 versions; the widest one the CPU supports is picked at
+// startup. Every search returns the index of the first matching byte, or the size of the buffer if there is none.
+//
+// Digits and '%' are deliberately not classified here. The lexer looks at them once per token, at bytes the bit scan
+// has just brought into cache, and on number-heavy scripts digit and '%' masks were slower than the byte checks in
+// Lexer::nextToken() and Lexer::parseNumber(): about 5% for the masks alone and 10% for mask-validated decimals. SWAR
+// digit conversion on top of the masks made it 20% slower.
+class Scanner
+{
+public:
+    Scanner(const char * = nullptr, size_t = 0);
+
+    // First byte that is not whitespace (as classified by isspace() in the C locale).
+    size_t skipWhitespace(size_t);
+    // First whitespace byte, i.e. the end of the word starting at the given index.
+    size_t findWhitespace(size_t);
+    // First '\n', which ends a "%" line comment.
+    size_t findLineEnd(size_t) const;
+    // First "=%", which ends a "%=" block comment.
+    size_t findBlockCommentEnd(size_t) const;
+
+    static const char *getInstructionSet();
+
+private:
+    const char *data;
+    size_t size;
+
+    // Bit i is set if data[blockStart + i] is whitespace.
+    size_t blockStart;
+    uint64_t blockMask;
+
+    void loadBlock(size_t);
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+// FNV-1a style hash over 8-byte words, with a fold after every step so that high bits reach the low ones. Not
+// cryptographic; used to detect stale or corrupted compiled programs. Can be chained by passing the previous result.
+uint64_t hashBytes(const char *, size_t, uint64_t = 0xcbf29ce484222325);
+
+struct SourceLocation
+{
+    int lineNum;
+    int column;
+    std::string_view line;
+};
+
+// Read-only view over the text of a script. Files are memory-mapped so that tokens can point straight into the
+// mapping instead of owning a copy of their text; strings passed to the interpreter are owned by the source.
+// Tokens only store offsets into the source, and the line table used to turn an offset back into a line and column
+// is built the first time a diagnostic asks for one.
+class Source
+{
+public:
+    static std::shared_ptr<const Source> fromFile(const std::string &);
+    static std::shared_ptr<const Source> fromString(std::string);
+
+    [[nodiscard]] std::string_view view() const;
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] uint64_t hash() const;
+    [[nodiscard]] SourceLocation locate(uint32_t) const;
+
+private:
+    Source() = default;
+
+    boost::iostreams::mapped_file_source mapping;
+    std::string buffer;
+    std::string_view text;
+
+    mutable std::once_flag lineStartsBuilt;
+    mutable std::vector<uint32_t> lineStarts;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "geometry.h"
+#include "planner.h"
+
+// One "SM" command for the EBB: both motors turn by the given number of steps, at constant speed, over the given time.
+struct StepPacket
+{
+    uint32_t milliseconds;
+    int32_t motor1, motor2;
+};
+
+// Turns planned moves into StepPackets ahead of time, so that streaming them to the board is only formatting and
+// writing. The speed ramps are sliced every SLICE_MS and the cruise at constant speed between them becomes a single
+// packet. Steps and milliseconds are whole numbers in a packet; what rounding leaves over is carried into the next
+// packet, and on into the next path, so the carriage is never off by more than half a step. Packets that would not
+// move a motor a whole step, or would take less than a millisecond, are merged into the next one.
+class StepCompiler
+{
+public:
+    // Motor steps per inch at 1/16 microstepping ("EM,1,1"), which is what pyaxidraw uses by default.
+    static constexpr double STEPS_PER_INCH = 2032;
+    // Fastest step rate of the EBB's motor outputs, in steps per second.
+    static constexpr int64_t MAX_STEP_RATE = 25000;
+    // Longest slice of a speed ramp, in milliseconds.
+    static constexpr double SLICE_MS = 25;
+
+    StepCompiler();
+
+    // Appends the packets for the given moves, which start at getPosition().
+    void compile(const std::vector<PlannedMove> &, std::vector<StepPacket> &);
+    // Starts over at the home position, with nothing carried over.
+    void reset();
+
+    // Where the last compiled path ended, in inches.
+    [[nodiscard]] Point getPosition() const;
+
+private:
+    // Position in steps along X and Y from the home position, up to the last packet.
+    int64_t stepX, stepY;
+    // Steps and milliseconds not sent yet: the fractions left by rounding, and whole ones waiting to be merged.
+    double carryX, carryY, carryMs;
+
+    void advance(double, double, double, std::vector<StepPacket> &);
+    int64_t emit(int64_t, int64_t, int64_t, std::vector<StepPacket> &);
+};
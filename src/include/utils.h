@@ -1,7 +1,12 @@
 #pragma once
 
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <string_view>
 #include <vector>
 
 #if __has_include(<experimental/source_location>)
@@ -12,83 +17,132 @@
 #    error "Missing <experimental/source_location> or <source_location>"
 #endif
 
+#include "source.h"
+
 #pragma region DataStructures
 
+// Every token type in declaration order, with the keyword that spells it in a script ("" if it has none). The
+// Token::Type enum, Token::typeToCStr() and the lexer's keyword table are all generated from this one list.
+#define AXILANG_TOKEN_TYPES(X)             \
+    /* General commands */                 \
+    X(Mode,            "MODE")             \
+    X(Opts,            "OPTS")             \
+    X(EndOpts,         "END_OPTS")         \
+    X(UOpts,           "UOPTS")            \
+    X(EndUOpts,        "END_UOPTS")        \
+                                           \
+    /* Modes */                            \
+    X(PlotMode,        "P")                \
+    X(InteractiveMode, "I")                \
+                                           \
+    /* General options */                  \
+    X(Acceleration,    "ACCEL")            \
+    X(PenUpPosition,   "PENU_POS")         \
+    X(PenDownPosition, "PEND_POS")         \
+    X(PenUpDelay,      "PENU_DELAY")       \
+    X(PenDownDelay,    "PEND_DELAY")       \
+    X(PenUpSpeed,      "PENU_SPEED")       \
+    X(PenDownSpeed,    "PEND_SPEED")       \
+    X(PenUpRate,       "PENU_RATE")        \
+    X(PenDownRate,     "PEND_RATE")        \
+    X(Model,           "MODEL")            \
+    X(Port,            "PORT")             \
+                                           \
+    /* Interactive options */              \
+    X(Units,           "UNITS")            \
+                                           \
+    /* Interactive commands */             \
+    X(Connect,         "CONNECT")          \
+    X(Disconnect,      "DISCONNECT")       \
+    X(PenUp,           "PENUP")            \
+    X(PenDown,         "PENDOWN")          \
+    X(PenToggle,       "PENTOGGLE")        \
+    X(Home,            "HOME")             \
+    X(GoTo,            "GOTO")             \
+    X(GoToRelative,    "GOTO_REL")         \
+    X(Draw,            "DRAW")             \
+    X(Wait,            "WAIT")             \
+    X(GetPos,          "GETPOS")           \
+    X(GetPen,          "GETPEN")           \
+    X(Sync,            "SYNC")             \
+                                           \
+    /* Plot commands */                    \
+    X(SetPlot,         "SETPLOT")          \
+    X(Plot,            "PLOT")             \
+                                           \
+    /* Data types */                       \
+    X(Number,          "")                 \
+    X(String,          "")                 \
+                                           \
+    /* Other */                            \
+    X(Unknown,         "")                 \
+    X(EndOfFile,       "")
+
 struct Token
 {
     enum Type
     {
-        // General commands
-        Mode,
-        Opts,
-        EndOpts,
-        UOpts,
-        EndUOpts,
-
-        // Modes
-        PlotMode,
-        InteractiveMode,
-
-        // General options
-        Acceleration,
-        PenUpPosition,
-        PenDownPosition,
-        PenUpDelay,
-        PenDownDelay,
-        PenUpSpeed,
-        PenDownSpeed,
-        PenUpRate,
-        PenDownRate,
-        Model,
-        Port,
-
-        // Interactive options
-        Units,
-
-        // Interactive commands
-        Connect,
-        Disconnect,
-        PenUp,
-        PenDown,
-        PenToggle,
-        Home,
-        GoTo,
-        GoToRelative,
-        Draw,
-        Wait,
-        GetPos,
-        GetPen,
-
-        // Plot commands
-        SetPlot,
-        Plot,
-
-        // Data types
-        Number,
-        String,
-
-        // Other
-        Unknown,
-        EndOfFile
+#define X(name, keyword) name,
+        AXILANG_TOKEN_TYPES(X)
+#undef X
+    };
+
+    static constexpr const char *typeNames[] = {
+#define X(name, keyword) #name,
+            AXILANG_TOKEN_TYPES(X)
+#undef X
+    };
+    static constexpr std::string_view keywords[] = {
+#define X(name, keyword) keyword,
+            AXILANG_TOKEN_TYPES(X)
+#undef X
     };
+    static constexpr size_t typeCount = sizeof(typeNames) / sizeof(typeNames[0]);
 
+    // The text of a token is found through its offset into the source (see FileState::text()).
     Type type;
-    std::string value;
+    uint32_t offset, length;
+    double number;
 
-    Token(Type type, std::string value) : type(type), value(std::move(value)) {}
-    [[nodiscard]] std::string typeToCStr() const;
+    Token(Type type, uint32_t offset, uint32_t length, double number = 0)
+            : type(type), offset(offset), length(length), number(number) {}
+    [[nodiscard]] constexpr const char *typeToCStr() const
+    {
+        return typeNames[type];
+    }
 };
 
 struct FileState
 {
+    std::shared_ptr<const Source> source;
     std::vector<Token> tokens;
-    std::vector<std::string> lines;
-    std::vector<int> lineNums;
-    std::vector<int> linePositions;
+
+    // Index of the token being processed, which diagnostics point at.
+    size_t cursor = 0;
 
     [[nodiscard]] bool isEmpty() const
     {
-        return tokens.empty() || lines.empty() || lineNums.empty() || linePositions.empty();
+        return tokens.empty() || !source;
+    }
+
+    [[nodiscard]] std::string_view text(const Token &token) const
+    {
+        return source->view().substr(token.offset, token.length);
+    }
+};
+
+struct Point
+{
+    double x, y;
+
+    bool operator==(const Point &other) const
+    {
+        return x == other.x && y == other.y;
+    }
+
+    bool operator!=(const Point &other) const
+    {
+        return !(*this == other);
     }
 };
 
@@ -209,10 +263,28 @@ inline std::string sanitize(const std::string &str)
     return trim(cleanedText);
 }
 
+inline std::string formatDuration(double seconds)
+{
+    char buffer[32];
+    long minutes = static_cast<long>(std::abs(seconds)) / 60;
+
+    if (minutes >= 60)
+        snprintf(buffer, sizeof(buffer), "%s%ldh %02ldm %04.1fs", seconds < 0 ? "-" : "", minutes / 60, minutes % 60,
+                 std::abs(seconds) - static_cast<double>(minutes) * 60);
+    else if (minutes > 0)
+        snprintf(buffer, sizeof(buffer), "%s%ldm %04.1fs", seconds < 0 ? "-" : "", minutes,
+                 std::abs(seconds) - static_cast<double>(minutes) * 60);
+    else snprintf(buffer, sizeof(buffer), "%.1fs", seconds);
+
+    return buffer;
+}
+
 #pragma endregion
 #pragma region Logger
 
-static bool debug = false;
+inline bool debug = false;
+// Set by --stats: backends report how much work it took to talk to the plotter.
+inline bool stats = false;
 
 class Log
 {
@@ -226,7 +298,7 @@ public:
         INFO
     };
 
-    Log(Type type, const std::string &message, FileState fs = {}, bool shouldExitOnError = true,
+    Log(Type type, const std::string &message, const FileState &fs = {}, bool shouldExitOnError = true,
 #if __has_include(<experimental/source_location>)
         const std::string &functionName = std::experimental::source_location::current().function_name()
 #elif __has_include(<source_location>)
@@ -236,12 +308,14 @@ public:
 #endif
        )
     {
+        SourceLocation location = {};
         if (!fs.isEmpty())
         {
-            padding = std::string(
-                    fs.linePositions[fs.linePositions.size() - 1] - fs.tokens[fs.tokens.size() - 1].value.length(),
-                    ' ');
-            carets = std::string(fs.tokens[fs.tokens.size() - 1].value.length(), '^');
+            const Token &token = fs.tokens[std::min(fs.cursor, fs.tokens.size() - 1)];
+
+            location = fs.source->locate(token.offset);
+            padding = std::string(location.column, ' ');
+            carets = std::string(std::max<uint32_t>(token.length, 1), '^');
         }
 
         switch (type)
@@ -254,8 +328,8 @@ public:
             case Type::ERROR:
             {
                 if (!fs.isEmpty())
-                    std::cerr << "[\033[1;31mERROR\033[0m]: On line " << fs.lineNums[fs.lineNums.size() - 1] << ".\n  "
-                              << fs.lines[fs.lines.size() - 1] << "\n  " << padding << "\033[1;31m" << carets << "\n  "
+                    std::cerr << "[\033[1;31mERROR\033[0m]: On line " << location.lineNum << ".\n  "
+                              << location.line << "\n  " << padding << "\033[1;31m" << carets << "\n  "
                               << message << "\033[0m" << std::endl;
                 else std::cerr << "[\033[1;31mERROR\033[0m]: " << message << std::endl;
 
@@ -265,8 +339,8 @@ public:
             case Type::WARN:
             {
                 if (!fs.isEmpty())
-                    std::cerr << "[\033[1;33mWARNING\033[0m]: On line " << fs.lineNums[fs.lineNums.size() - 1]
-                              << ".\n  " << fs.lines[fs.lines.size() - 1] << "\n  " << padding << "\033[1;33m" << carets
+                    std::cerr << "[\033[1;33mWARNING\033[0m]: On line " << location.lineNum
+                              << ".\n  " << location.line << "\n  " << padding << "\033[1;33m" << carets
                               << "\n  " << message << "\033[0m" << std::endl;
                 else std::cerr << "[\033[1;33mWARNING\033[0m]: " << message << std::endl;
                 break;
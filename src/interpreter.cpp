@@ -1,6 +1,6 @@
 #include "include/interpreter.h"
 
-Interpreter::Interpreter() : parser(fileState, false) {}
+Interpreter::Interpreter(const std::string &backend) : parser(fileState, false), executor(backend) {}
 
 void Interpreter::run()
 {
@@ -111,23 +111,13 @@ void Interpreter::printHelp()
 
 void Interpreter::execute(const std::string &str)
 {
-    for (const auto &token: lexer.lexInput(str))
-    {
-        Log(Log::Type::DEBUG, "Token: " + token.value + " (" + token.typeToCStr() + ")");
-        while (token.type != Token::Type::EndOfFile)
-        {
-            fileState.tokens.push_back(token);
-            fileState.lines.push_back(str);
-            fileState.lineNums.push_back(lexer.getLineNumber());
-            fileState.linePositions.push_back(lexer.getLinePosition());
-        }
-    }
+    FileState lineState;
+    lineState.tokens = lexer.lexInput(str);
+    lineState.source = lexer.getSource();
 
-    Log(Log::Type::DEBUG, "State: [Tokens: " + std::to_string(fileState.tokens.size()) +
-                          ", Lines: " + std::to_string(fileState.lines.size()) +
-                          ", Line Numbers: " + std::to_string(fileState.lineNums.size()) +
-                          ", Line Positions: " + std::to_string(fileState.linePositions.size()) + "]");
+    Log(Log::Type::DEBUG, "State: [Tokens: " + std::to_string(lineState.tokens.size()) + "]");
+    for (const auto &token: lineState.tokens)
+        Log(Log::Type::DEBUG, "  " + std::string(lineState.text(token)) + ": " + token.typeToCStr());
 
-    for (const auto &token: fileState.tokens) Log(Log::Type::DEBUG, "  " + token.value + ": " + token.typeToCStr());
-    parser.parse();
+    executor.run(parser.parse(std::move(lineState)).view());
 }
@@ -1,210 +1,293 @@
 #include "include/lexer.h"
 
-std::string Token::typeToCStr() const
-{
-    assert(Token::Type::EndOfFile == 36);
-
-    static const std::map<Token::Type, std::string> tokenMap = {
-            {Token::Type::Mode,            "Mode"},
-            {Token::Type::Opts,            "Opts"},
-            {Token::Type::EndOpts,         "EndOpts"},
-            {Token::Type::UOpts,           "UOpts"},
-            {Token::Type::EndUOpts,        "EndUOpts"},
-            {Token::Type::PlotMode,        "PlotMode"},
-            {Token::Type::InteractiveMode, "InteractiveMode"},
-            {Token::Type::Acceleration,    "Acceleration"},
-            {Token::Type::PenUpPosition,   "PenUpPosition"},
-            {Token::Type::PenDownPosition, "PenDownPosition"},
-            {Token::Type::PenUpDelay,      "PenUpDelay"},
-            {Token::Type::PenDownDelay,    "PenDownDelay"},
-            {Token::Type::PenUpSpeed,      "PenUpSpeed"},
-            {Token::Type::PenDownSpeed,    "PenDownSpeed"},
-            {Token::Type::PenUpRate,       "PenUpRate"},
-            {Token::Type::PenDownRate,     "PenDownRate"},
-            {Token::Type::Model,           "Model"},
-            {Token::Type::Port,            "Port"},
-            {Token::Type::Units,           "Units"},
-            {Token::Type::Connect,         "Connect"},
-            {Token::Type::Disconnect,      "Disconnect"},
-            {Token::Type::PenUp,           "PenUp"},
-            {Token::Type::PenDown,         "PenDown"},
-            {Token::Type::PenToggle,       "PenToggle"},
-            {Token::Type::Home,            "Home"},
-            {Token::Type::GoTo,            "GoTo"},
-            {Token::Type::GoToRelative,    "GoToRelative"},
-            {Token::Type::Draw,            "Draw"},
-            {Token::Type::Wait,            "Wait"},
-            {Token::Type::GetPos,          "GetPos"},
-            {Token::Type::GetPen,          "GetPen"},
-            {Token::Type::SetPlot,         "SetPlot"},
-            {Token::Type::Plot,            "Plot"},
-            {Token::Type::Number,          "Number"},
-            {Token::Type::String,          "String"},
-            {Token::Type::Unknown,         "Unknown"},
-            {Token::Type::EndOfFile,       "EndOfFile"},
-    };
-
-    auto it = tokenMap.find(type);
-    if (it == tokenMap.end()) throw std::runtime_error("Invalid token type.");
-
-    return it->second;
+#pragma region Keywords
+
+// Keywords are looked up through a perfect hash: the seed is searched for at compile time so that every keyword lands
+// in its own slot, which leaves a single string comparison per word on the lexing hot path.
+static constexpr uint32_t keywordSlots = 128;
+
+static constexpr uint32_t keywordHash(std::string_view str, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+    for (char c: str) hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+
+    return (hash ^ (hash >> 15)) & (keywordSlots - 1);
+}
+
+static constexpr bool isPerfectSeed(uint32_t seed)
+{
+    bool used[keywordSlots] = {};
+    for (std::string_view keyword: Token::keywords)
+    {
+        if (keyword.empty()) continue;
+
+        uint32_t slot = keywordHash(keyword, seed);
+        if (used[slot]) return false;
+        used[slot] = true;
+    }
+
+    return true;
+}
+
+static constexpr uint32_t findKeywordSeed()
+{
+    uint32_t seed = 0;
+    while (!isPerfectSeed(seed)) seed++;
+
+    return seed;
+}
+
+struct KeywordTable
+{
+    uint32_t seed;
+    Token::Type slots[keywordSlots];
+};
+
+static constexpr KeywordTable buildKeywordTable()
+{
+    KeywordTable table = {findKeywordSeed(), {}};
+    for (auto &slot: table.slots) slot = Token::Type::Unknown;
+
+    for (size_t type = 0; type < Token::typeCount; type++)
+        if (!Token::keywords[type].empty())
+            table.slots[keywordHash(Token::keywords[type], table.seed)] = static_cast<Token::Type>(type);
+
+    return table;
 }
 
+static constexpr KeywordTable keywordTable = buildKeywordTable();
+
+#pragma endregion
+
 Lexer::Lexer(const std::string &path)
 {
     if (!boost::filesystem::exists(path)) Log(Log::Type::FATAL, "File does not exist.");
     if (boost::filesystem::file_size(path) == 0) Log(Log::Type::FATAL, "File is empty.");
+    if (boost::filesystem::file_size(path) > UINT32_MAX) Log(Log::Type::FATAL, "File is larger than 4 GiB.");
 
-    file.open(path);
-    lineNum = 0;
-    linePos = 0;
+    reset(Source::fromFile(path));
 }
 
 Lexer::Lexer()
 {
-    lineNum = 0;
-    linePos = 0;
-
-    file.close();
+    reset(Source::fromString(""));
 }
 
-Lexer::~Lexer()
+Lexer::Lexer(std::shared_ptr<const Source> chunkSource, size_t begin, size_t chunkEnd)
+        : source(std::move(chunkSource)), reportsUnknown(false)
 {
-    file.close();
+    text = source->view();
+    scanner = Scanner(text.data(), chunkEnd);
+    pos = begin;
+    end = chunkEnd;
 }
 
-Token Lexer::nextToken(bool isSingleLine)
+void Lexer::reset(std::shared_ptr<const Source> newSource)
 {
-    assert(Token::Type::EndOfFile == 36);
+    source = std::move(newSource);
+    text = source->view();
+    scanner = Scanner(text.data(), text.length());
+    pos = 0;
+    end = text.length();
+}
 
-    if (linePos >= (int) line.length())
+Token Lexer::nextToken()
+{
+    while (true)
     {
-        if (file.eof() || isSingleLine) return {Token::Type::EndOfFile, "EOF"};
+        pos = scanner.skipWhitespace(pos);
+
+        if (pos >= end) return {Token::Type::EndOfFile, static_cast<uint32_t>(end), 0};
+        if (text[pos] != '%') break;
 
-        std::getline(file, line);
-        lineNum++;
-        linePos = 0;
+        pos++;
+        if (pos < end && text[pos] == '=')
+        {
+            pos = scanner.findBlockCommentEnd(pos + 1);
+            endsInComment = pos >= end;
+            pos = std::min(pos + 2, end);
+        } else pos = scanner.findLineEnd(pos);
     }
 
-    while (linePos < (int) line.length() && isspace(line[linePos])) linePos++;
+    size_t start = pos;
+    pos = scanner.findWhitespace(pos);
 
-    if (linePos < (int) line.length() && line[linePos] == '%')
-    {
-        linePos++;
-        if (linePos < (int) line.length() && line[linePos] == '=')
-        {
-            linePos++;
-            while (linePos < (int) line.length() && !(line[linePos] == '=' && line[linePos + 1] == '%'))
-                linePos++;
+    std::string_view value = text.substr(start, pos - start);
+    double number;
+
+    // No keyword starts with a digit, a sign or a dot, so numbers skip the keyword lookup.
+    char first = value[0];
+    if (((first >= '0' && first <= '9') || first == '-' || first == '+' || first == '.') && parseNumber(value, number))
+        return {Token::Type::Number, static_cast<uint32_t>(start), static_cast<uint32_t>(value.length()), number};
+
+    Token::Type type = getTokenType(value);
+    if (type == Token::Type::Unknown && value[0] == '"')
+        return {Token::Type::String, static_cast<uint32_t>(start + 1),
+                static_cast<uint32_t>(value.length() > 1 ? value.length() - 2 : 0)};
 
-            linePos += 2;
-        } else while (linePos < (int) line.length() && line[linePos] != '\n') linePos++;
+    Token token(type, static_cast<uint32_t>(start), static_cast<uint32_t>(value.length()));
+    if (type == Token::Type::Unknown && reportsUnknown) reportUnknownToken(token);
 
-        return nextToken(isSingleLine);
+    return token;
+}
+
+void Lexer::reportUnknownToken(const Token &token) const
+{
+    std::string_view value = text.substr(token.offset, token.length);
+    SourceLocation location = source->locate(token.offset);
+
+    Log(Log::Type::ERROR,
+        "Unknown token \"" + std::string(value) + "\" on line " + std::to_string(location.lineNum) + ".\n  " +
+        std::string(location.line) + "\n  " + std::string(location.column, ' ') + "\033[1;31m" +
+        std::string(value.length(), '^') + "\033[0m");
+}
+
+std::vector<Token> Lexer::lexAll(unsigned threads)
+{
+    static constexpr size_t minChunkSize = 1 << 20;
+
+    std::vector<Token> tokens;
+    size_t chunkCount = std::min<size_t>(threads * 4, (end - pos) / minChunkSize);
+
+    if (threads <= 1 || chunkCount < 2)
+    {
+        for (Token token = nextToken(); token.type != Token::Type::EndOfFile; token = nextToken())
+            tokens.push_back(token);
+
+        return tokens;
     }
 
-    std::string value;
-    while (linePos < (int) line.length() && !isspace(line[linePos]))
+    // Chunks start right after a line break. No token and no comment delimiter can span a line break, so the only
+    // state carried from one chunk into the next is whether a block comment is still open.
+    std::vector<size_t> bounds = {pos};
+    for (size_t i = 1; i < chunkCount; i++)
     {
-        value += line[linePos];
-        linePos++;
+        size_t lineEnd = text.find('\n', std::max(pos + (end - pos) * i / chunkCount, bounds.back()));
+        if (lineEnd == std::string_view::npos || lineEnd + 1 >= end) break;
+
+        bounds.push_back(lineEnd + 1);
     }
+    bounds.push_back(end);
 
-    Token::Type type = getTokenType(value);
-    if (type == Token::Type::Unknown)
+    // Every chunk is first lexed as if it started outside a comment.
+    std::vector<std::pair<std::vector<Token>, bool>> chunks(bounds.size() - 1);
+    parallelFor(chunks.size(), threads, [&](size_t i)
     {
-        if (value.empty()) return nextToken(isSingleLine);
-        if (std::all_of(value.begin(), value.end(), ::isdigit)) return {Token::Type::Number, value};
+        Lexer chunkLexer(source, bounds[i], bounds[i + 1]);
+        for (Token token = chunkLexer.nextToken(); token.type != Token::Type::EndOfFile; token = chunkLexer.nextToken())
+            chunks[i].first.push_back(token);
+
+        chunks[i].second = chunkLexer.endsInComment;
+    });
 
-        if (value[0] == '"')
+    // A chunk that actually starts inside a block comment is lexed again from the end of that comment.
+    size_t tokenCount = 0;
+    bool isInComment = false;
+
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        if (isInComment)
         {
-            value = value.substr(1, value.length() - 2);
-            return {Token::Type::String, value};
+            Lexer chunkLexer(source, bounds[i], bounds[i + 1]);
+            size_t commentEnd = chunkLexer.scanner.findBlockCommentEnd(bounds[i]);
+
+            chunks[i].first.clear();
+            if (commentEnd >= bounds[i + 1]) continue;
+
+            chunkLexer.pos = commentEnd + 2;
+            for (Token token = chunkLexer.nextToken();
+                 token.type != Token::Type::EndOfFile; token = chunkLexer.nextToken())
+                chunks[i].first.push_back(token);
+
+            chunks[i].second = chunkLexer.endsInComment;
         }
 
-        Log(Log::Type::ERROR,
-            "Unknown token \"" + value + "\" on line " + std::to_string(lineNum) + ".\n  " + line + "\n  " +
-            std::string(linePos - value.length(), ' ') + "\033[1;31m" + std::string(value.length(), '^') + "\033[0m");
+        isInComment = chunks[i].second;
+        tokenCount += chunks[i].first.size();
     }
 
-    return {type, value};
+    tokens.reserve(tokenCount);
+    for (const auto &chunk: chunks) tokens.insert(tokens.end(), chunk.first.begin(), chunk.first.end());
+
+    auto unknownToken = std::find_if(tokens.begin(), tokens.end(), [](const Token &token)
+    {
+        return token.type == Token::Type::Unknown;
+    });
+    if (unknownToken != tokens.end()) reportUnknownToken(*unknownToken);
+
+    pos = end;
+    return tokens;
 }
 
 std::vector<Token> Lexer::lexInput(const std::string &input)
 {
-    assert(Token::Type::EndOfFile == 36);
-
-    lineNum = 0;
-    linePos = 0;
-    line = input;
+    reset(Source::fromString(input));
 
     std::vector<Token> tokens;
-    Token token = nextToken(true);
+    Token token = nextToken();
 
     while (token.type != Token::Type::EndOfFile)
     {
         tokens.push_back(token);
-        token = nextToken(true);
+        token = nextToken();
     }
 
     return tokens;
 }
 
-int Lexer::getLineNumber() const
+std::shared_ptr<const Source> Lexer::getSource() const
 {
-    return lineNum;
+    return source;
 }
 
-int Lexer::getLinePosition() const
+Token::Type Lexer::getTokenType(std::string_view value)
 {
-    return linePos;
+    Token::Type type = keywordTable.slots[keywordHash(value, keywordTable.seed)];
+    return Token::keywords[type] == value ? type : Token::Type::Unknown;
 }
 
-std::string Lexer::getLine() const
+bool Lexer::parseNumber(std::string_view value, double &number)
 {
-    return line;
-}
+    static constexpr double powersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+                                             1e14, 1e15};
+
+    bool isNegative = !value.empty() && value[0] == '-';
+    if (!value.empty() && (value[0] == '+' || isNegative)) value.remove_prefix(1);
+    if (value.empty() || !((value[0] >= '0' && value[0] <= '9') || value[0] == '.')) return false;
+
+    // Plain decimals such as "12.375" have their digits accumulated as an integer and scaled by an exact power of
+    // ten. Both fit in a double's mantissa, so the division is correctly rounded and gives what std::from_chars
+    // would (Clinger's fast path).
+    uint64_t mantissa = 0;
+    int digits = 0, fractionDigits = 0;
+    bool hasDot = false;
+    size_t i = 0;
+
+    for (; i < value.length(); i++)
+    {
+        char c = value[i];
+        if (c >= '0' && c <= '9')
+        {
+            mantissa = mantissa * 10 + (c - '0');
+            digits++;
+            fractionDigits += hasDot;
+        } else if (c == '.' && !hasDot) hasDot = true;
+        else break;
+    }
+
+    if (i == value.length() && digits > 0 && digits <= 15)
+    {
+        number = static_cast<double>(mantissa) / powersOfTen[fractionDigits];
+        if (isNegative) number = -number;
+
+        return true;
+    }
+
+    // Exponents and long mantissas go through std::from_chars, which is locale independent and does not throw. The
+    // sign was stripped above since from_chars rejects a leading '+'.
+    auto result = std::from_chars(value.data(), value.data() + value.length(), number);
+    if (result.ec != std::errc() || result.ptr != value.data() + value.length()) return false;
 
-Token::Type Lexer::getTokenType(const std::string &value)
-{
-    static const std::map<std::string, Token::Type> tokenMap = {
-            {"MODE",       Token::Type::Mode},
-            {"OPTS",       Token::Type::Opts},
-            {"END_OPTS",   Token::Type::EndOpts},
-            {"UOPTS",      Token::Type::UOpts},
-            {"END_UOPTS",  Token::Type::EndUOpts},
-            {"P",          Token::Type::PlotMode},
-            {"I",          Token::Type::InteractiveMode},
-            {"ACCEL",      Token::Type::Acceleration},
-            {"PENU_POS",   Token::Type::PenUpPosition},
-            {"PEND_POS",   Token::Type::PenDownPosition},
-            {"PENU_DELAY", Token::Type::PenUpDelay},
-            {"PEND_DELAY", Token::Type::PenDownDelay},
-            {"PENU_SPEED", Token::Type::PenUpSpeed},
-            {"PEND_SPEED", Token::Type::PenDownSpeed},
-            {"PENU_RATE",  Token::Type::PenUpRate},
-            {"PEND_RATE",  Token::Type::PenDownRate},
-            {"MODEL",      Token::Type::Model},
-            {"PORT",       Token::Type::Port},
-            {"UNITS",      Token::Type::Units},
-            {"CONNECT",    Token::Type::Connect},
-            {"DISCONNECT", Token::Type::Disconnect},
-            {"PENUP",      Token::Type::PenUp},
-            {"PENDOWN",    Token::Type::PenDown},
-            {"PENTOGGLE",  Token::Type::PenToggle},
-            {"HOME",       Token::Type::Home},
-            {"GOTO",       Token::Type::GoTo},
-            {"GOTO_REL",   Token::Type::GoToRelative},
-            {"DRAW",       Token::Type::Draw},
-            {"WAIT",       Token::Type::Wait},
-            {"GETPOS",     Token::Type::GetPos},
-            {"GETPEN",     Token::Type::GetPen},
-            {"SETPLOT",    Token::Type::SetPlot},
-            {"PLOT",       Token::Type::Plot},
-    };
-
-    auto it = tokenMap.find(value);
-    if (it == tokenMap.end()) return Token::Type::Unknown;
-
-    return it->second;
+    if (isNegative) number = -number;
+    return true;
 }
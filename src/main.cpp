@@ -1,25 +1,210 @@
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <map>
+#include <optional>
 #include <string>
 
 #include <boost/program_options.hpp>
 
+#include "include/compiled.h"
+#include "include/emulator.h"
+#include "include/estimator.h"
+#include "include/executor.h"
 #include "include/lexer.h"
+#include "include/optimizer.h"
 #include "include/parser.h"
+#include "include/preview.h"
 #include "include/interpreter.h"
 #include "include/utils.h"
 
 namespace po = boost::program_options;
 
+static void benchmarkLexer(const std::string &fileName, unsigned maxThreads)
+{
+    std::vector<unsigned> threadCounts;
+    for (unsigned threads = 1; threads < maxThreads; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    std::vector<Token> reference = Lexer(fileName).lexAll(1);
+    double baseline = 0;
+
+    std::ostringstream report;
+    report << "Lexer benchmark for \"" << fileName << "\" (" << Scanner::getInstructionSet() << " kernels, "
+           << reference.size() << " tokens, best of 3 runs):\n  Threads        Time      MB/s   Speedup";
+
+    for (unsigned threads: threadCounts)
+    {
+        double best = 0;
+        size_t size = 0;
+
+        for (int run = 0; run < 3; run++)
+        {
+            Lexer lexer(fileName);
+            auto start = std::chrono::steady_clock::now();
+            std::vector<Token> tokens = lexer.lexAll(threads);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            bool isSame = tokens.size() == reference.size() &&
+                          std::equal(tokens.begin(), tokens.end(), reference.begin(), [](const Token &a, const Token &b)
+                          {
+                              return a.type == b.type && a.offset == b.offset && a.length == b.length;
+                          });
+            if (!isSame)
+                Log(Log::Type::FATAL, "Lexing with " + std::to_string(threads) + " threads gave different tokens.");
+
+            best = run == 0 ? seconds : std::min(best, seconds);
+            size = lexer.getSource()->size();
+        }
+
+        if (threads == 1) baseline = best;
+        report << "\n  " << std::setw(7) << threads << std::fixed << std::setprecision(3) << std::setw(11) << best
+               << "s" << std::setprecision(1) << std::setw(10) << size / best / 1e6 << std::setprecision(2)
+               << std::setw(9) << baseline / best << "x";
+    }
+
+    Log(Log::Type::INFO, report.str());
+}
+
+// Reads a --clip value: "model", or a page rectangle as "X0,Y0,X1,Y1".
+static bool parseClipArea(const std::string &value, std::optional<Rect> &page)
+{
+    if (value == "model")
+    {
+        page.reset();
+        return true;
+    }
+
+    Rect rect = {};
+    char extra;
+    if (sscanf(value.c_str(), "%lf,%lf,%lf,%lf%c", &rect.minX, &rect.minY, &rect.maxX, &rect.maxY, &extra) != 4)
+        return false;
+
+    page = Rect{std::min(rect.minX, rect.maxX), std::min(rect.minY, rect.maxY), std::max(rect.minX, rect.maxX),
+                std::max(rect.minY, rect.maxY)};
+    return true;
+}
+
+// Describes the optimization passes that were asked for. It is part of the key of compiled programs, since a program
+// compiled with other passes would run differently.
+static std::string optimizationSettings(const po::variables_map &vm)
+{
+    std::ostringstream settings;
+    settings << std::setprecision(17);
+
+    if (vm.count("clip")) settings << "clip=" << vm["clip"].as<std::string>() << ";";
+    if (vm.count("simplify")) settings << "simplify=" << vm["simplify"].as<double>() << ";";
+    if (vm.count("dedupe")) settings << "dedupe=" << vm["dedupe"].as<double>() << ";";
+    if (vm.count("join")) settings << "join=" << vm["join"].as<double>() << ";";
+    if (vm.count("reorder")) settings << "reorder;";
+    if (vm.count("rotate-closed")) settings << "rotate=" << vm["rotate-closed"].as<std::string>() << ";";
+    if (vm.count("optimize")) settings << "peephole;";
+
+    return settings.str();
+}
+
+static void optimize(Program &program, const po::variables_map &vm, unsigned threads)
+{
+    Optimizer optimizer(program, threads);
+
+    // Passes that move paths around run first, so that the peephole pass can clean up after them.
+    if (vm.count("clip"))
+    {
+        std::optional<Rect> page;
+        parseClipArea(vm["clip"].as<std::string>(), page);
+        optimizer.clip(page);
+    }
+    if (vm.count("simplify")) optimizer.simplify(vm["simplify"].as<double>());
+    if (vm.count("dedupe")) optimizer.dedupe(vm["dedupe"].as<double>());
+    if (vm.count("join")) optimizer.join(vm["join"].as<double>());
+    if (vm.count("reorder")) optimizer.reorder();
+    if (vm.count("rotate-closed")) optimizer.rotateClosed(vm["rotate-closed"].as<std::string>() == "random");
+    if (vm.count("optimize")) optimizer.peephole();
+}
+
+static void printEstimate(const ProgramView &program, bool isPerLine)
+{
+    std::map<uint32_t, Estimate> lines;
+    Estimate total = Estimator().estimate(program, isPerLine ? &lines : nullptr);
+
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(2) << "Estimated plot time: " << formatDuration(total.seconds)
+           << "\n  Pen-down distance: " << total.penDownDistance << " in (" << total.penDownDistance * 2.54 << " cm)"
+           << "\n  Pen-up distance:   " << total.penUpDistance << " in (" << total.penUpDistance * 2.54 << " cm)"
+           << "\n  Pen lifts:         " << total.penLifts;
+
+    if (isPerLine)
+    {
+        report << "\n     Line         Time   Down (in)     Up (in)   Lifts";
+        for (const auto &[line, estimate]: lines)
+        {
+            if (estimate.seconds <= 0 && estimate.penDownDistance <= 0 && estimate.penUpDistance <= 0) continue;
+
+            report << "\n  " << std::setw(7) << line << std::setw(13) << formatDuration(estimate.seconds)
+                   << std::setw(12) << estimate.penDownDistance << std::setw(12) << estimate.penUpDistance
+                   << std::setw(8) << estimate.penLifts;
+        }
+    }
+
+    Log(Log::Type::INFO, report.str());
+}
+
+// Runs a parsed or compiled program on the AxiDraw, or only estimates how long it would take and/or renders a preview.
+static void run(const ProgramView &program, const po::variables_map &vm, unsigned threads)
+{
+    bool isEstimate = vm.count("estimate") || vm.count("estimate-lines");
+    if (isEstimate) printEstimate(program, vm.count("estimate-lines"));
+    if (vm.count("preview"))
+        Preview(vm["preview-dpi"].as<double>(), vm.count("preview-travel"), threads)
+                .render(program, vm["preview"].as<std::string>());
+
+    if (!isEstimate && !vm.count("preview")) Executor(vm["backend"].as<std::string>()).run(program);
+}
+
 int main(int argc, char **argv)
 {
-    std::string fileName;
+    std::string fileName, outputName;
+    unsigned threads = defaultThreadCount();
 
     po::options_description description("Allowed options");
     description.add_options()
             ("help,h", "Print this help message and exit")
             ("version,v", "Print the version number and exit")
             ("debug,d", "Show extra information while running")
+            ("stats", "Report how many calls or commands it took to talk to the plotter")
             ("file,f", po::value<std::string>(&fileName), "Input file path")
-            ("interactive,i", "Start an interactive interpreter");
+            ("interactive,i", "Start an interactive interpreter")
+            ("backend", po::value<std::string>()->default_value("pyaxidraw"), "How to talk to the AxiDraw: through "
+                                                                              "pyaxidraw (\"pyaxidraw\") or directly "
+                                                                              "over USB (\"ebb\"); or run without "
+                                                                              "one, doing nothing (\"null\") or "
+                                                                              "recording every call (\"mock\")")
+            ("threads,j", po::value<unsigned>(&threads), "Number of threads used to lex and optimize large files "
+                                                         "(default: one per hardware thread)")
+            ("bench-lex", "Measure lexing throughput of the input file with 1 up to --threads threads, then exit")
+            ("optimize,O", "Remove redundant commands before running")
+            ("reorder", "Reorder and reverse DRAW paths to minimize pen-up travel")
+            ("clip", po::value<std::string>(), "Clip GOTO and DRAW to the travel envelope of the MODEL (\"model\") "
+                                               "or to a page rectangle \"X0,Y0,X1,Y1\" in the active UNITS")
+            ("simplify", po::value<double>(), "Simplify DRAW paths to within this distance, in the active UNITS")
+            ("dedupe", po::value<double>(), "Remove DRAW segments that retrace already drawn ones, comparing "
+                                            "coordinates rounded to this grid size")
+            ("join", po::value<double>(), "Join DRAW paths whose ends are within this distance into continuous strokes")
+            ("rotate-closed", po::value<std::string>(), "Start closed DRAW paths at the vertex nearest to the pen "
+                                                        "(\"nearest\") or at a random vertex (\"random\")")
+            ("estimate", "Print the estimated plot time, pen-down and pen-up distance and pen lifts instead of plotting")
+            ("estimate-lines", "Like --estimate, also broken down by source line")
+            ("preview", po::value<std::string>(), "Render the pen-down strokes to a PNG image instead of plotting")
+            ("preview-dpi", po::value<double>()->default_value(96), "Resolution of --preview, in pixels per inch")
+            ("preview-travel", "Also draw pen-up travel in --preview")
+            ("compile,c", "Compile the input file to a binary program (.axc) and exit")
+            ("output,o", po::value<std::string>(&outputName), "Output path for --compile (default: the input file with "
+                                                              "an .axc extension), or the motion log of --emulate-ebb")
+            ("emulate-ebb", "Emulate an EiBotBoard on a pseudo-terminal for testing --backend ebb without an AxiDraw")
+            ("emulate-latency", po::value<double>()->default_value(0), "Round-trip time of a command to the emulated "
+                                                                        "EiBotBoard, in milliseconds")
+            ("emulate-fifo", po::value<unsigned>()->default_value(1), "Number of moves the emulated EiBotBoard queues "
+                                                                       "behind the one it is executing");
 
     po::positional_options_description p;
     p.add("file", -1);
@@ -58,11 +243,50 @@ int main(int argc, char **argv)
             return EXIT_FAILURE;
         }
 
+    std::optional<Rect> page;
+    if (vm.count("clip") && !parseClipArea(vm["clip"].as<std::string>(), page))
+    {
+        Log(Log::Type::ERROR, "Invalid value for --clip. Expected \"model\" or \"X0,Y0,X1,Y1\".");
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count("rotate-closed") && vm["rotate-closed"].as<std::string>() != "nearest" &&
+        vm["rotate-closed"].as<std::string>() != "random")
+    {
+        Log(Log::Type::ERROR, "Invalid value for --rotate-closed. Expected \"nearest\" or \"random\".");
+        return EXIT_FAILURE;
+    }
+
+    if (!Plotter::isBackend(vm["backend"].as<std::string>()))
+    {
+        Log(Log::Type::ERROR, "Invalid value for --backend. Expected \"pyaxidraw\", \"ebb\", \"null\" or \"mock\".");
+        return EXIT_FAILURE;
+    }
+
+    if (vm["preview-dpi"].as<double>() <= 0 || vm["preview-dpi"].as<double>() > 600)
+    {
+        Log(Log::Type::ERROR, "Invalid value for --preview-dpi. Expected a number greater than 0 and up to 600.");
+        return EXIT_FAILURE;
+    }
+
+    if (vm["emulate-latency"].as<double>() < 0)
+    {
+        Log(Log::Type::ERROR, "Invalid value for --emulate-latency. Expected a number of milliseconds.");
+        return EXIT_FAILURE;
+    }
+
     if (vm.count("debug")) Log(Log::Type::INFO, "DEBUG mode enabled.").enableDebug();
+    if (vm.count("stats")) stats = true;
+    if (vm.count("emulate-ebb"))
+    {
+        EbbEmulator(vm["emulate-latency"].as<double>(), vm["emulate-fifo"].as<unsigned>(), outputName).run();
+        return EXIT_SUCCESS;
+    }
+
     if (vm.count("interactive"))
     {
         Log(Log::Type::INFO, "Starting AxiLang interpreter.");
-        Interpreter().run();
+        Interpreter(vm["backend"].as<std::string>()).run();
 
         return EXIT_SUCCESS;
     }
@@ -83,27 +307,99 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    Log(Log::Type::DEBUG, std::string("Parsing file \"") + fileName + "\".");
+    Log(Log::Type::DEBUG, std::string("Parsing file \"") + fileName + "\" (" + Scanner::getInstructionSet() +
+                          " lexer kernels).");
+
+    if (vm.count("bench-lex"))
+    {
+        benchmarkLexer(fileName, std::max(threads, 1u));
+        return EXIT_SUCCESS;
+    }
+
+    if (CompiledProgram::isCompiled(fileName))
+    {
+        if (vm.count("compile"))
+        {
+            Log(Log::Type::ERROR, "\"" + fileName + "\" is already compiled.");
+            return EXIT_FAILURE;
+        }
+
+        std::string reason;
+        CompiledProgram compiled;
+        if (!compiled.open(fileName, reason))
+        {
+            Log(Log::Type::ERROR, "\"" + fileName + "\" " + reason + ".");
+            return EXIT_FAILURE;
+        }
+
+        run(compiled.view(), vm, threads);
+        return EXIT_SUCCESS;
+    }
+
+    std::string compiledName = CompiledProgram::defaultPath(fileName);
+    if (vm.count("compile"))
+    {
+        if (outputName.empty()) outputName = compiledName;
+
+        // A script that already ends in .axc, or an -o pointing back at it, would be overwritten by its own program.
+        boost::system::error_code error;
+        if (boost::filesystem::equivalent(fileName, outputName, error))
+        {
+            Log(Log::Type::ERROR, "Refusing to compile \"" + fileName + "\" over itself; choose another path with -o.");
+            return EXIT_FAILURE;
+        }
+    }
 
     Lexer lexer(fileName);
-    Token token = lexer.nextToken();
+    std::string settings = optimizationSettings(vm);
 
-    FileState fileState;
-    while (token.type != Token::Type::EndOfFile)
+    // A compiled program next to the script is used instead of the script as long as it was built from the same text.
+    if (!vm.count("compile") && compiledName != fileName && boost::filesystem::exists(compiledName))
     {
-        fileState.tokens.push_back(token);
-        fileState.lines.push_back(lexer.getLine());
-        fileState.lineNums.push_back(lexer.getLineNumber());
-        fileState.linePositions.push_back(lexer.getLinePosition());
+        std::string reason;
+        CompiledProgram compiled;
+
+        if (!compiled.open(compiledName, reason))
+            Log(Log::Type::WARN, "Ignoring \"" + compiledName + "\": it " + reason + ".");
+        else if (!compiled.matches(hashBytes(settings.data(), settings.size(), lexer.getSource()->hash()),
+                                         lexer.getSource()->size()))
+            Log(Log::Type::DEBUG, "Ignoring \"" + compiledName + "\": the source has changed since it was compiled.");
+        else
+        {
+            Log(Log::Type::DEBUG, "Running compiled program \"" + compiledName + "\".");
 
-        token = lexer.nextToken();
+            run(compiled.view(), vm, threads);
+            return EXIT_SUCCESS;
+        }
     }
 
+    FileState fileState;
+    fileState.source = lexer.getSource();
+    fileState.tokens = lexer.lexAll(threads);
+
     Log(Log::Type::DEBUG, "Tokens: ");
-    for (const auto &tok: fileState.tokens) Log(Log::Type::DEBUG, "  " + tok.typeToCStr() + ": " + tok.value);
+    if (debug)
+        for (const auto &tok: fileState.tokens)
+            Log(Log::Type::DEBUG, std::string("  ") + tok.typeToCStr() + ": " + std::string(fileState.text(tok)));
+
+    Program program = Parser(fileState).parse();
+    optimize(program, vm, threads);
+
+    Log(Log::Type::DEBUG, "Program: " + std::to_string(program.instructions.size()) + " instructions, " +
+                          std::to_string(program.points.size()) + " points.");
+
+    if (vm.count("compile"))
+    {
+        CompiledProgram::write(outputName, program.view(),
+                               hashBytes(settings.data(), settings.size(), lexer.getSource()->hash()),
+                               lexer.getSource()->size());
+        Log(Log::Type::INFO, "Compiled \"" + fileName + "\" to \"" + outputName + "\" (" +
+                             std::to_string(program.instructions.size()) + " instructions, " +
+                             std::to_string(program.points.size()) + " points).");
+        return EXIT_SUCCESS;
+    }
 
-    Parser parser(fileState);
-    parser.parse();
+    run(program.view(), vm, threads);
 
     inFile.close();
     return EXIT_SUCCESS;
@@ -0,0 +1,268 @@
+#include "include/mock.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "include/program.h"
+
+MockPlotter::MockPlotter(bool isRecording)
+        : isRecording(isRecording), isInteractive(false), isPenUp(true), position({0, 0}), time(0), calls(0),
+          created(std::chrono::steady_clock::now()) {}
+
+MockPlotter::~MockPlotter()
+{
+    if (!isRecording) return;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - created).count();
+    Log(Log::Type::INFO, "Recorded " + std::to_string(calls) + " calls in " + std::to_string(seconds * 1000) +
+                         " ms (" + std::to_string(static_cast<double>(calls) / std::max(seconds, 1e-9)) +
+                         " calls/s). On an AxiDraw they would take " + std::to_string(time) + " s.");
+}
+
+void MockPlotter::record(const char *name, const std::vector<double> &arguments, double duration,
+                         const std::string &text)
+{
+    if (!isRecording) return;
+
+    if (debug)
+    {
+        std::string line = "[" + std::to_string(time) + " s] " + name + "(" + (text.empty() ? "" : "\"" + text + "\"");
+        for (size_t i = 0; i < arguments.size(); i++)
+            line += (i > 0 || !text.empty() ? ", " : "") + std::to_string(arguments[i]);
+        Log(Log::Type::DEBUG, line + ")");
+    }
+
+    calls++;
+    time += duration;
+}
+
+double MockPlotter::setPen(bool up)
+{
+    if (up == isPenUp) return 0;
+    isPenUp = up;
+
+    if (!isRecording) return 0;
+    return (servoMoveTime(std::abs(active.penUpPosition - active.penDownPosition),
+                          up ? active.penUpRate : active.penDownRate) +
+            std::max(up ? active.penUpDelay : active.penDownDelay, 0.0)) / 1000;
+}
+
+double MockPlotter::moveTo(const Point *targets, size_t count, bool penDown)
+{
+    const ModelSpec &model = MODEL_SPECS[active.model];
+    double unitsPerInch = UNITS_PER_INCH[active.units], seconds = setPen(!penDown);
+
+    waypoints.assign(1, position);
+    for (size_t i = 0; i < count; i++)
+        waypoints.push_back(Rect{0, 0, model.width, model.height}.clamp({targets[i].x / unitsPerInch,
+                                                                    targets[i].y / unitsPerInch}));
+    position = waypoints.back();
+
+    if (!isRecording) return seconds;
+
+    MotionPlanner planner(motionLimits(penDown, penDown ? active.penDownSpeed : active.penUpSpeed,
+                                       active.acceleration));
+    for (const PlannedMove &move: planner.plan(waypoints.data(), waypoints.size())) seconds += move.duration();
+
+    return seconds;
+}
+
+#pragma region General
+
+void MockPlotter::setAcceleration(double acceleration)
+{
+    pending.acceleration = acceleration;
+    record("setAcceleration", {acceleration});
+}
+
+void MockPlotter::setPenUpPosition(double position)
+{
+    pending.penUpPosition = position;
+    record("setPenUpPosition", {position});
+}
+
+void MockPlotter::setPenDownPosition(double position)
+{
+    pending.penDownPosition = position;
+    record("setPenDownPosition", {position});
+}
+
+void MockPlotter::setPenUpDelay(double delay)
+{
+    pending.penUpDelay = delay;
+    record("setPenUpDelay", {delay});
+}
+
+void MockPlotter::setPenDownDelay(double delay)
+{
+    pending.penDownDelay = delay;
+    record("setPenDownDelay", {delay});
+}
+
+void MockPlotter::setPenUpSpeed(double speed)
+{
+    pending.penUpSpeed = speed;
+    record("setPenUpSpeed", {speed});
+}
+
+void MockPlotter::setPenDownSpeed(double speed)
+{
+    pending.penDownSpeed = speed;
+    record("setPenDownSpeed", {speed});
+}
+
+void MockPlotter::setPenUpRate(double rate)
+{
+    pending.penUpRate = rate;
+    record("setPenUpRate", {rate});
+}
+
+void MockPlotter::setPenDownRate(double rate)
+{
+    pending.penDownRate = rate;
+    record("setPenDownRate", {rate});
+}
+
+void MockPlotter::setModel(int model)
+{
+    pending.model = std::clamp(model, 1, static_cast<int>(MODEL_COUNT) - 1);
+    record("setModel", {static_cast<double>(model)});
+}
+
+void MockPlotter::setPort(const std::string &port)
+{
+    pending.port = port;
+    record("setPort", {}, 0, port);
+}
+
+std::string MockPlotter::getMode()
+{
+    record("getMode");
+    return isInteractive ? "interactive" : "plot";
+}
+
+#pragma endregion
+#pragma region Interactive
+
+void MockPlotter::modeInteractive()
+{
+    isInteractive = true;
+    record("modeInteractive");
+}
+
+void MockPlotter::setUnits(int units)
+{
+    pending.units = std::clamp(units, 0, 2);
+    record("setUnits", {static_cast<double>(units)});
+}
+
+void MockPlotter::connect()
+{
+    active = pending;
+    position = {0, 0};
+    record("connect", {}, setPen(true));
+}
+
+void MockPlotter::disconnect()
+{
+    record("disconnect");
+}
+
+void MockPlotter::updateOptions()
+{
+    active = pending;
+    record("updateOptions");
+}
+
+void MockPlotter::penUp()
+{
+    record("penUp", {}, setPen(true));
+}
+
+void MockPlotter::penDown()
+{
+    record("penDown", {}, setPen(false));
+}
+
+void MockPlotter::penToggle()
+{
+    record("penToggle", {}, setPen(!isPenUp));
+}
+
+void MockPlotter::home()
+{
+    Point target = {0, 0};
+    record("home", {}, moveTo(&target, 1, false));
+}
+
+void MockPlotter::goTo(double x, double y)
+{
+    Point target = {x, y};
+    record("goTo", {x, y}, moveTo(&target, 1, false));
+}
+
+void MockPlotter::goToRelative(double x, double y)
+{
+    double unitsPerInch = UNITS_PER_INCH[active.units];
+    Point target = {position.x * unitsPerInch + x, position.y * unitsPerInch + y};
+    record("goToRelative", {x, y}, moveTo(&target, 1, false));
+}
+
+void MockPlotter::draw(const Point *path, size_t count)
+{
+    if (count == 0) return;
+
+    double seconds = moveTo(path, 1, false);
+    if (count > 1) seconds += moveTo(path + 1, count - 1, true);
+
+    // The points are only needed for the --debug line, where they are flattened into x, y pairs.
+    std::vector<double> arguments;
+    if (isRecording && debug)
+    {
+        arguments.reserve(count * 2);
+        for (size_t i = 0; i < count; i++) arguments.insert(arguments.end(), {path[i].x, path[i].y});
+    }
+    record("draw", arguments, seconds);
+}
+
+void MockPlotter::wait(double ms)
+{
+    record("wait", {ms}, std::max(ms, 0.0) / 1000);
+}
+
+std::pair<double, double> MockPlotter::getPosition()
+{
+    record("getPosition");
+
+    double unitsPerInch = UNITS_PER_INCH[active.units];
+    return {position.x * unitsPerInch, position.y * unitsPerInch};
+}
+
+bool MockPlotter::getPen()
+{
+    record("getPen");
+
+    // True while the pen is down, which is how the executor reports it.
+    return !isPenUp;
+}
+
+void MockPlotter::sync()
+{
+    record("sync");
+}
+
+#pragma endregion
+#pragma region Plot
+
+void MockPlotter::modePlot(const std::string &file)
+{
+    isInteractive = false;
+    record("modePlot", {}, 0, file);
+}
+
+void MockPlotter::runPlot()
+{
+    record("runPlot");
+}
+
+#pragma endregion
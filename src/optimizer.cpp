@@ -0,0 +1,1047 @@
+#include "include/optimizer.h"
+
+enum class PenState
+{
+    Unknown,
+    Up,
+    Down,
+};
+
+// Paths are compared with the this many paths after them during 2-opt.
+static constexpr size_t TWO_OPT_WINDOW = 16;
+static constexpr int TWO_OPT_MAX_PASSES = 8;
+
+// Paths are simplified in this many batches per thread, to even out paths of very different lengths.
+static constexpr size_t BATCHES_PER_THREAD = 8;
+
+Optimizer::Optimizer(Program &program, unsigned threads) : program(program), threads(threads) {}
+
+#pragma region Runs
+
+static bool isRunCommand(const Instruction &instruction)
+{
+    return instruction.op == Instruction::Op::Draw || instruction.op == Instruction::Op::Move ||
+           instruction.op == Instruction::Op::PenUp;
+}
+
+void Optimizer::rewriteRuns(const std::function<void(Run &)> &pass)
+{
+    std::vector<Instruction> instructions;
+    std::vector<Point> points;
+    instructions.reserve(program.instructions.size());
+    points.reserve(program.points.size());
+
+    Point position = {0, 0};
+    auto copyDraw = [&](const Polyline &path)
+    {
+        Instruction &draw = instructions.emplace_back(Instruction{Instruction::Op::Draw, path.line, 0, 0, 0, 0});
+        draw.first = static_cast<uint32_t>(points.size());
+        draw.count = path.count;
+
+        if (path.isReversed)
+            points.insert(points.end(), program.points.rbegin() + (program.points.size() - path.first - path.count),
+                          program.points.rbegin() + (program.points.size() - path.first));
+        else points.insert(points.end(), program.points.begin() + path.first,
+                           program.points.begin() + path.first + path.count);
+
+        position = points.back();
+    };
+
+    for (size_t index = 0; index < program.instructions.size();)
+    {
+        const Instruction &instruction = program.instructions[index];
+        if (!isRunCommand(instruction))
+        {
+            if (instruction.op == Instruction::Op::Connect) position = {0, 0};
+            // Only a guess, without the clamping the plotter does, but it is only used to order the next run.
+            if (instruction.op == Instruction::Op::MoveRelative)
+                position = {position.x + instruction.x, position.y + instruction.y};
+
+            instructions.push_back(instruction);
+            index++;
+            continue;
+        }
+
+        size_t end = index;
+        while (end < program.instructions.size() && isRunCommand(program.instructions[end])) end++;
+
+        Run run = {position, {}, std::nullopt, std::nullopt, std::nullopt};
+        std::optional<size_t> last;
+
+        for (size_t i = index; i < end; i++)
+        {
+            const Instruction &command = program.instructions[i];
+            if (command.op == Instruction::Op::PenUp) continue;
+
+            last = i;
+            if (command.op == Instruction::Op::Draw && command.count > 1)
+                run.paths.push_back({command.first, command.count, command.line, false});
+        }
+
+        if (run.paths.empty())
+        {
+            // Nothing to rearrange; the run is copied as it is.
+            for (size_t i = index; i < end; i++)
+            {
+                const Instruction &command = program.instructions[i];
+                if (command.op == Instruction::Op::Draw) copyDraw({command.first, command.count, command.line, false});
+                else
+                {
+                    instructions.push_back(command);
+                    if (command.op == Instruction::Op::Move) position = {command.x, command.y};
+                }
+            }
+
+            index = end;
+            continue;
+        }
+
+        const Instruction &lastCommand = program.instructions[*last];
+        bool isEndSeen = end < program.instructions.size() &&
+                         program.instructions[end].op != Instruction::Op::Disconnect;
+
+        if (lastCommand.op == Instruction::Op::Move)
+            run.end = lastCommand;
+        else if (lastCommand.count == 1)
+        {
+            // A single-point DRAW is a move to that point.
+            run.end = lastCommand;
+            run.end->op = Instruction::Op::Move;
+            run.end->x = program.points[lastCommand.first].x;
+            run.end->y = program.points[lastCommand.first].y;
+            run.end->first = run.end->count = 0;
+        } else if (isEndSeen)
+        {
+            run.pinned = run.paths.back();
+            run.paths.pop_back();
+        }
+
+        if (program.instructions[end - 1].op == Instruction::Op::PenUp) run.penUp = program.instructions[end - 1];
+
+        pass(run);
+
+        for (const Polyline &path: run.paths) copyDraw(path);
+        if (run.pinned) copyDraw(*run.pinned);
+        if (run.end)
+        {
+            instructions.push_back(*run.end);
+            position = {run.end->x, run.end->y};
+        }
+        if (run.penUp) instructions.push_back(*run.penUp);
+
+        index = end;
+    }
+
+    program.instructions = std::move(instructions);
+    program.points = std::move(points);
+}
+
+#pragma endregion
+#pragma region Joining
+
+// Closest remaining end within the tolerance.
+static bool findEnd(PointGrid &grid, const std::vector<Point> &ends, const Point &point, double tolerance, uint32_t &id)
+{
+    double best = INFINITY;
+    grid.forEachWithin(point, tolerance, [&](uint32_t candidate)
+    {
+        double candidateDistance = distanceSquared(ends[candidate], point);
+        if (candidateDistance < best)
+        {
+            best = candidateDistance;
+            id = candidate;
+        }
+    });
+
+    return best != INFINITY;
+}
+
+void Optimizer::join(double tolerance)
+{
+    Estimate before = Estimator().estimate(program.view());
+    size_t pathsBefore = 0, pathsAfter = 0;
+
+    rewriteRuns([&](Run &run)
+    {
+        pathsBefore += run.paths.size();
+
+        std::vector<Point> ends(run.paths.size() * 2);
+        for (size_t i = 0; i < run.paths.size(); i++)
+        {
+            ends[i * 2] = run.paths[i].start(program.points);
+            ends[i * 2 + 1] = run.paths[i].end(program.points);
+        }
+
+        PointGrid grid(ends);
+        std::vector<Polyline> strokes;
+
+        for (uint32_t seed = 0; seed < run.paths.size(); seed++)
+        {
+            if (!grid.contains(seed * 2)) continue;
+            grid.remove(seed * 2);
+            grid.remove(seed * 2 + 1);
+
+            std::deque<Polyline> chain = {run.paths[seed]};
+            uint32_t id = 0;
+
+            // Extend forwards from the end of the stroke, entering each path at the end that is closest...
+            while (findEnd(grid, ends, chain.back().end(program.points), tolerance, id))
+            {
+                Polyline next = run.paths[id / 2];
+                if (id % 2 == 1) next.isReversed = !next.isReversed;
+
+                grid.remove(id & ~1u);
+                grid.remove(id | 1u);
+                chain.push_back(next);
+            }
+
+            // ...then backwards from its start, leaving each path at the end that is closest.
+            while (findEnd(grid, ends, chain.front().start(program.points), tolerance, id))
+            {
+                Polyline previous = run.paths[id / 2];
+                if (id % 2 == 0) previous.isReversed = !previous.isReversed;
+
+                grid.remove(id & ~1u);
+                grid.remove(id | 1u);
+                chain.push_front(previous);
+            }
+
+            if (chain.size() == 1)
+            {
+                strokes.push_back(chain.front());
+                continue;
+            }
+
+            auto first = static_cast<uint32_t>(program.points.size());
+            for (const Polyline &path: chain)
+                for (uint32_t i = 0; i < path.count; i++)
+                {
+                    Point point = path.at(program.points, i);
+                    if (i == 0 && program.points.size() > first && point == program.points.back()) continue;
+
+                    program.points.push_back(point);
+                }
+
+            strokes.push_back({first, static_cast<uint32_t>(program.points.size()) - first, chain.front().line, false});
+        }
+
+        pathsAfter += strokes.size();
+        run.paths = std::move(strokes);
+    });
+
+    Estimate after = Estimator().estimate(program.view());
+    Log(Log::Type::INFO, "Path joining merged " + std::to_string(pathsBefore) + " paths into " +
+                         std::to_string(pathsAfter) + " strokes, removing " +
+                         std::to_string(before.penLifts - after.penLifts) + " pen lifts. Estimated time saved: " +
+                         formatDuration(before.seconds - after.seconds) + ".");
+}
+
+#pragma endregion
+#pragma region Rotation
+
+void Optimizer::rotateClosed(bool isRandom)
+{
+    Estimate before = Estimator().estimate(program.view());
+    size_t closed = 0, rotated = 0;
+
+    // Fixed seed, so that compiling the same script twice gives the same program.
+    std::mt19937 random(0x41584c);
+
+    rewriteRuns([&](Run &run)
+    {
+        Point position = run.start;
+
+        for (size_t index = 0; index < run.paths.size(); index++)
+        {
+            Polyline &path = run.paths[index];
+
+            if (path.count < 4 || path.start(program.points) != path.end(program.points))
+            {
+                position = path.end(program.points);
+                continue;
+            }
+
+            // The last point repeats the first, so there are count - 1 distinct vertices to start from.
+            uint32_t vertices = path.count - 1, best = 0;
+            if (isRandom) best = std::uniform_int_distribution<uint32_t>(0, vertices - 1)(random);
+            else
+            {
+                // The pen also leaves from the vertex it starts at, so when the next stop is known, the travel to it
+                // counts as well. Otherwise this is the vertex nearest to the pen.
+                std::optional<Point> next;
+                if (index + 1 < run.paths.size()) next = run.paths[index + 1].start(program.points);
+                else if (run.pinned) next = run.pinned->start(program.points);
+                else if (run.end) next = Point{run.end->x, run.end->y};
+
+                auto cost = [&](uint32_t vertex)
+                {
+                    const Point &point = path.at(program.points, vertex);
+                    return distance(point, position) + (next ? distance(point, *next) : 0);
+                };
+
+                double bestCost = cost(0);
+                for (uint32_t i = 1; i < vertices; i++)
+                {
+                    double candidate = cost(i);
+                    if (candidate < bestCost)
+                    {
+                        bestCost = candidate;
+                        best = i;
+                    }
+                }
+            }
+
+            closed++;
+            if (best != 0)
+            {
+                rotated++;
+
+                auto first = static_cast<uint32_t>(program.points.size());
+                for (uint32_t i = 0; i <= vertices; i++)
+                {
+                    Point point = path.at(program.points, (best + i) % vertices);
+                    program.points.push_back(point);
+                }
+
+                path = {first, vertices + 1, path.line, false};
+            }
+
+            position = path.end(program.points);
+        }
+    });
+
+    Estimate after = Estimator().estimate(program.view());
+    std::ostringstream report;
+    report << "Closed path rotation changed the start of " << rotated << " of " << closed << " closed paths. Pen-up "
+           << "travel: " << std::fixed << std::setprecision(2) << before.penUpDistance << " in -> "
+           << after.penUpDistance << " in.";
+    Log(Log::Type::INFO, report.str());
+}
+
+#pragma endregion
+#pragma region Clipping
+
+void Optimizer::clip(const std::optional<Rect> &page)
+{
+    // pyaxidraw defaults: AxiDraw V2/V3 (model 1), in inches. Like on the plotter, OPTS only take effect on the next
+    // CONNECT or UOPTS.
+    int model = 1, units = 0, pendingModel = 1, pendingUnits = 0;
+    auto envelope = [&]() -> Rect
+    {
+        return {0, 0, MODEL_SPECS[model].width * UNITS_PER_INCH[units],
+                MODEL_SPECS[model].height * UNITS_PER_INCH[units]};
+    };
+    auto area = [&]() -> Rect
+    {
+        return page ? *page : envelope();
+    };
+
+    std::vector<Instruction> instructions;
+    std::vector<Point> points;
+    std::vector<double> enter, exit;
+    instructions.reserve(program.instructions.size());
+    points.reserve(program.points.size());
+
+    // Lengths in inches.
+    double drawn = 0, discarded = 0;
+    size_t removed = 0, split = 0, clamped = 0;
+
+    bool isOpen = false;
+    auto closePiece = [&]()
+    {
+        // A piece that only touches the area is a single point, which draws nothing.
+        if (isOpen && instructions.back().count < 2)
+        {
+            points.pop_back();
+            instructions.pop_back();
+        }
+        isOpen = false;
+    };
+    auto startPiece = [&](const Point &point, uint32_t line)
+    {
+        closePiece();
+        instructions.push_back({Instruction::Op::Draw, line, static_cast<uint32_t>(points.size()), 1, 0, 0});
+        points.push_back(point);
+        isOpen = true;
+    };
+
+    // Where the script left the carriage, when a DRAW that was cut short or removed left it elsewhere, and whether the
+    // script had the pen down there. A removed DRAW also does not lower the pen (isPenLost). Both are only put back
+    // before a command that depends on them, so that nothing is drawn where the script did not draw.
+    std::optional<Point> lostPosition;
+    bool isLostPenDown = false, isPenLost = false;
+    auto forget = [&]()
+    {
+        lostPosition.reset();
+        isLostPenDown = isPenLost = false;
+    };
+    auto restorePosition = [&](uint32_t line)
+    {
+        if (!lostPosition) return;
+
+        instructions.push_back({Instruction::Op::Move, line, 0, 0, lostPosition->x, lostPosition->y});
+        lostPosition.reset();
+        // The move raises the pen.
+        isPenLost = isLostPenDown;
+    };
+    auto restorePen = [&](uint32_t line)
+    {
+        if (!isPenLost) return;
+
+        restorePosition(line);
+        instructions.push_back({Instruction::Op::PenDown, line, 0, 0, 0, 0});
+        isPenLost = false;
+    };
+
+    for (const Instruction &instruction: program.instructions)
+    {
+        switch (instruction.op)
+        {
+            case Instruction::Op::Options:
+            case Instruction::Op::UpdateOptions:
+            {
+                for (uint32_t i = 0; i < instruction.count; i++)
+                {
+                    const Option &option = program.options[instruction.first + i];
+
+                    if (option.name == Token::Type::Model) pendingModel = static_cast<int>(option.value);
+                    if (option.name == Token::Type::Units) pendingUnits = static_cast<int>(option.value);
+                }
+
+                if (instruction.op == Instruction::Op::UpdateOptions)
+                {
+                    if (lostPosition)
+                        lostPosition = Point{lostPosition->x * UNITS_PER_INCH[pendingUnits] / UNITS_PER_INCH[units],
+                                             lostPosition->y * UNITS_PER_INCH[pendingUnits] / UNITS_PER_INCH[units]};
+                    model = pendingModel;
+                    units = pendingUnits;
+                }
+
+                instructions.push_back(instruction);
+                break;
+            }
+            case Instruction::Op::Connect:
+            {
+                model = pendingModel;
+                units = pendingUnits;
+                forget();
+
+                instructions.push_back(instruction);
+                break;
+            }
+            case Instruction::Op::InteractiveMode:
+            case Instruction::Op::PlotMode:
+            {
+                forget();
+                instructions.push_back(instruction);
+                break;
+            }
+            case Instruction::Op::PenUp:
+            {
+                isLostPenDown = isPenLost = false;
+                instructions.push_back(instruction);
+                break;
+            }
+            case Instruction::Op::PenDown:
+            {
+                restorePosition(instruction.line);
+                forget();
+                instructions.push_back(instruction);
+                break;
+            }
+            case Instruction::Op::PenToggle:
+            {
+                if (!lostPosition && !isPenLost)
+                {
+                    instructions.push_back(instruction);
+                    break;
+                }
+
+                // The state the toggle would start from is not the one the plotter has, so it becomes explicit.
+                if (isLostPenDown)
+                {
+                    instructions.push_back({Instruction::Op::PenUp, instruction.line, 0, 0, 0, 0});
+                    isLostPenDown = isPenLost = false;
+                } else
+                {
+                    restorePosition(instruction.line);
+                    forget();
+                    instructions.push_back({Instruction::Op::PenDown, instruction.line, 0, 0, 0, 0});
+                }
+                break;
+            }
+            case Instruction::Op::MoveRelative:
+            case Instruction::Op::GetPos:
+            {
+                restorePosition(instruction.line);
+                if (instruction.op == Instruction::Op::MoveRelative) forget();
+
+                instructions.push_back(instruction);
+                break;
+            }
+            case Instruction::Op::GetPen:
+            case Instruction::Op::Sync:
+            {
+                if (instruction.op == Instruction::Op::Sync) restorePosition(instruction.line);
+                restorePen(instruction.line);
+
+                instructions.push_back(instruction);
+                break;
+            }
+            case Instruction::Op::Move:
+            {
+                Point target = area().clamp({instruction.x, instruction.y});
+                if (target != Point{instruction.x, instruction.y}) clamped++;
+
+                Instruction &move = instructions.emplace_back(instruction);
+                move.x = target.x;
+                move.y = target.y;
+                forget();
+                break;
+            }
+            case Instruction::Op::Draw:
+            {
+                const Point *source = program.points.data() + instruction.first;
+                Rect rect = area();
+
+                if (instruction.count == 1)
+                {
+                    if (!rect.contains(source[0])) clamped++;
+
+                    startPiece(rect.clamp(source[0]), instruction.line);
+                    isOpen = false;
+                    forget();
+                    break;
+                }
+
+                enter.resize(instruction.count - 1);
+                exit.resize(instruction.count - 1);
+                clipSegments(source, instruction.count, rect, enter.data(), exit.data());
+
+                size_t firstPiece = instructions.size();
+                for (uint32_t i = 0; i + 1 < instruction.count; i++)
+                {
+                    const Point &a = source[i], &b = source[i + 1];
+                    double length = distance(a, b) / UNITS_PER_INCH[units];
+                    drawn += length;
+
+                    if (enter[i] > exit[i])
+                    {
+                        discarded += length;
+                        closePiece();
+                        continue;
+                    }
+
+                    discarded += length * (1 - (exit[i] - enter[i]));
+                    if (!isOpen || enter[i] > 0)
+                        startPiece({a.x + (b.x - a.x) * enter[i], a.y + (b.y - a.y) * enter[i]}, instruction.line);
+
+                    Point end = exit[i] < 1 ? Point{a.x + (b.x - a.x) * exit[i], a.y + (b.y - a.y) * exit[i]} : b;
+                    if (end != points.back())
+                    {
+                        points.push_back(end);
+                        instructions.back().count++;
+                    }
+
+                    if (exit[i] < 1) closePiece();
+                }
+                closePiece();
+
+                // The plotter would have ended up at the last point, moved onto the envelope, with the pen down.
+                Point end = envelope().clamp(source[instruction.count - 1]);
+                forget();
+                if (instructions.size() == firstPiece)
+                {
+                    removed++;
+                    lostPosition = end;
+                    isLostPenDown = isPenLost = true;
+                } else
+                {
+                    if (instructions.size() > firstPiece + 1) split++;
+                    if (points.back() != end) lostPosition = end;
+                    isLostPenDown = true;
+                }
+                break;
+            }
+            default:
+                instructions.push_back(instruction);
+                break;
+        }
+    }
+
+    program.instructions = std::move(instructions);
+    program.points = std::move(points);
+
+    std::ostringstream report;
+    report << "Clipping to " << (page ? "the page" : "the MODEL envelope") << " discarded " << std::fixed
+           << std::setprecision(2) << discarded << " of " << drawn << " in of drawing (" << std::setprecision(1)
+           << (drawn > 0 ? 100 * discarded / drawn : 0) << "%): " << removed << " paths removed, " << split
+           << " split and " << clamped << " moves clamped.";
+    Log(discarded > 0 || clamped > 0 ? Log::Type::WARN : Log::Type::INFO, report.str());
+}
+
+#pragma endregion
+#pragma region Simplification
+
+void Optimizer::simplify(double tolerance)
+{
+    Estimate before = Estimator().estimate(program.view());
+
+    std::vector<size_t> draws;
+    for (size_t i = 0; i < program.instructions.size(); i++)
+        if (program.instructions[i].op == Instruction::Op::Draw) draws.push_back(i);
+
+    std::vector<uint8_t> keep(program.points.size(), 1);
+    size_t batches = std::min<size_t>(draws.size(), std::max(threads, 1u) * BATCHES_PER_THREAD);
+
+    parallelFor(batches, threads, [&](size_t batch)
+    {
+        for (size_t i = draws.size() * batch / batches; i < draws.size() * (batch + 1) / batches; i++)
+        {
+            const Instruction &draw = program.instructions[draws[i]];
+            simplifyPolyline(program.points.data() + draw.first, draw.count, tolerance, keep.data() + draw.first);
+        }
+    });
+
+    std::vector<Point> points;
+    points.reserve(program.points.size());
+
+    for (size_t index: draws)
+    {
+        Instruction &draw = program.instructions[index];
+        auto first = static_cast<uint32_t>(points.size());
+
+        for (uint32_t i = draw.first; i < draw.first + draw.count; i++) if (keep[i]) points.push_back(program.points[i]);
+
+        draw.first = first;
+        draw.count = static_cast<uint32_t>(points.size()) - first;
+    }
+
+    size_t vertices = program.points.size(), removed = vertices - points.size();
+    program.points = std::move(points);
+
+    Estimate after = Estimator().estimate(program.view());
+    std::ostringstream report;
+    report << "Simplification removed " << removed << " of " << vertices << " vertices (" << std::fixed
+           << std::setprecision(1) << (vertices ? 100.0 * removed / vertices : 0) << "%). Estimated time saved: "
+           << formatDuration(before.seconds - after.seconds) << ".";
+    Log(Log::Type::INFO, report.str());
+}
+
+#pragma endregion
+#pragma region Deduplication
+
+void Optimizer::dedupe(double step)
+{
+    Estimate before = Estimator().estimate(program.view());
+    size_t segments = 0, removed = 0, trimmed = 0;
+    // Splitting paths adds pen lifts, which can cost more than the travel saved, so the program is kept to go back to.
+    Program original = program;
+
+    SegmentSet drawn(step);
+    std::vector<std::pair<double, double>> uncovered;
+
+    rewriteRuns([&](Run &run)
+    {
+        std::vector<Polyline> paths;
+
+        for (const Polyline &path: run.paths)
+        {
+            std::optional<Polyline> current;
+            auto addPoint = [&](const Point &point)
+            {
+                if (!current)
+                {
+                    current = Polyline{static_cast<uint32_t>(program.points.size()), 0, path.line, false};
+                } else if (program.points.back() == point) return;
+
+                program.points.push_back(point);
+                current->count++;
+            };
+            auto endPath = [&]()
+            {
+                if (current && current->count > 1) paths.push_back(*current);
+                current.reset();
+            };
+
+            for (uint32_t i = 0; i + 1 < path.count; i++)
+            {
+                Point a = path.at(program.points, i), b = path.at(program.points, i + 1);
+                if (a == b) continue;
+
+                segments++;
+                drawn.add(a, b, uncovered);
+
+                if (uncovered.empty()) removed++;
+                else if (uncovered.size() > 1 || uncovered.front().first > 0 || uncovered.front().second < 1) trimmed++;
+
+                for (const auto &[from, to]: uncovered)
+                {
+                    Point start = {a.x + (b.x - a.x) * from, a.y + (b.y - a.y) * from};
+                    Point end = {a.x + (b.x - a.x) * to, a.y + (b.y - a.y) * to};
+
+                    if (from > 0) endPath();
+                    addPoint(start);
+                    addPoint(end);
+                    if (to < 1) endPath();
+                }
+
+                if (uncovered.empty()) endPath();
+            }
+
+            endPath();
+        }
+
+        // The pinned path has to end where it did, so it is kept whole; what it draws still counts for later paths.
+        if (run.pinned)
+            for (uint32_t i = 0; i + 1 < run.pinned->count; i++)
+                drawn.add(run.pinned->at(program.points, i), run.pinned->at(program.points, i + 1), uncovered);
+
+        run.paths = std::move(paths);
+    });
+
+    Estimate after = Estimator().estimate(program.view());
+    std::ostringstream report;
+    report << "Duplicate removal dropped " << removed << " and trimmed " << trimmed << " of " << segments
+           << " segments, cutting pen-down travel from " << std::fixed << std::setprecision(2)
+           << before.penDownDistance << " in to " << after.penDownDistance << " in. ";
+
+    if (after.seconds > before.seconds)
+    {
+        program = std::move(original);
+        report << "That would take " << formatDuration(after.seconds - before.seconds)
+               << " longer, so the program was left as it was.";
+    } else report << "Estimated time saved: " << formatDuration(before.seconds - after.seconds) << ".";
+
+    Log(Log::Type::INFO, report.str());
+}
+
+#pragma endregion
+#pragma region Reordering
+
+static double travel(const std::vector<Point> &points, const Point &start, const std::vector<Polyline> &paths,
+                     const Point *end)
+{
+    double total = 0;
+    Point position = start;
+
+    for (const Polyline &path: paths)
+    {
+        total += distance(position, path.start(points));
+        position = path.end(points);
+    }
+
+    return end ? total + distance(position, *end) : total;
+}
+
+static std::vector<Polyline> nearestNeighbourTour(const std::vector<Point> &points, const Run &run)
+{
+    std::vector<Point> ends(run.paths.size() * 2);
+    for (size_t i = 0; i < run.paths.size(); i++)
+    {
+        ends[i * 2] = run.paths[i].start(points);
+        ends[i * 2 + 1] = run.paths[i].end(points);
+    }
+
+    PointGrid grid(ends);
+    std::vector<Polyline> tour;
+    tour.reserve(run.paths.size());
+
+    Point position = run.start;
+    uint32_t id;
+
+    while (grid.nearest(position, id))
+    {
+        // Entering a path through its end means drawing it backwards.
+        Polyline path = run.paths[id / 2];
+        if (id % 2 == 1) path.isReversed = !path.isReversed;
+
+        grid.remove(id & ~1u);
+        grid.remove(id | 1u);
+
+        tour.push_back(path);
+        position = path.end(points);
+    }
+
+    return tour;
+}
+
+// Reversing tour[i..j] (and the direction of every path in it) only changes the travel into tour[i] and out of
+// tour[j]. Only nearby pairs are tried, which finds most of the gain in linear time.
+static void twoOpt(const std::vector<Point> &points, const Point &start, std::vector<Polyline> &tour, const Point *end)
+{
+    for (int pass = 0; pass < TWO_OPT_MAX_PASSES; pass++)
+    {
+        bool isImproved = false;
+
+        for (size_t i = 0; i < tour.size(); i++)
+        {
+            const Point before = i == 0 ? start : tour[i - 1].end(points);
+
+            for (size_t j = i; j < std::min(tour.size(), i + TWO_OPT_WINDOW); j++)
+            {
+                const Point *after = j + 1 < tour.size() ? &tour[j + 1].start(points) : end;
+                const Point &first = tour[i].start(points), &last = tour[j].end(points);
+
+                double current = distance(before, first) + (after ? distance(last, *after) : 0);
+                double reversed = distance(before, last) + (after ? distance(first, *after) : 0);
+                if (reversed >= current - 1e-12) continue;
+
+                std::reverse(tour.begin() + static_cast<ptrdiff_t>(i), tour.begin() + static_cast<ptrdiff_t>(j) + 1);
+                for (size_t k = i; k <= j; k++) tour[k].isReversed = !tour[k].isReversed;
+
+                isImproved = true;
+            }
+        }
+
+        if (!isImproved) break;
+    }
+}
+
+void Optimizer::reorder()
+{
+    Estimate before = Estimator().estimate(program.view());
+
+    rewriteRuns([this](Run &run)
+    {
+        if (run.paths.empty()) return;
+
+        Point endPoint = run.pinned ? run.pinned->start(program.points) : Point{run.end ? run.end->x : 0,
+                                                                                 run.end ? run.end->y : 0};
+        const Point *end = run.pinned || run.end ? &endPoint : nullptr;
+
+        std::vector<Polyline> tour = nearestNeighbourTour(program.points, run);
+        twoOpt(program.points, run.start, tour, end);
+
+        if (travel(program.points, run.start, tour, end) < travel(program.points, run.start, run.paths, end))
+            run.paths = std::move(tour);
+    });
+
+    Estimate after = Estimator().estimate(program.view());
+    double saved = before.penUpDistance > 0 ? 100 * (1 - after.penUpDistance / before.penUpDistance) : 0;
+
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(2) << "Path reordering cut pen-up travel from " << before.penUpDistance
+           << " in to " << after.penUpDistance << " in (" << std::setprecision(1) << saved << "% less). Estimated "
+           << "time saved: " << formatDuration(before.seconds - after.seconds) << ".";
+    Log(Log::Type::INFO, report.str());
+}
+
+#pragma endregion
+
+#pragma region Peephole
+
+void Optimizer::peephole()
+{
+    size_t commandsBefore = program.instructions.size(), pointsBefore = program.points.size();
+    Estimate before = Estimator().estimate(program.view());
+
+    std::vector<Instruction> instructions;
+    std::vector<Point> points;
+    std::vector<Option> options;
+    instructions.reserve(program.instructions.size());
+    points.reserve(program.points.size());
+
+    PenState pen = PenState::Unknown;
+    Point position = {0, 0};
+    bool isPositionKnown = false;
+
+    // Option values known to be set, and whether some were set by OPTS without being sent to the AxiDraw yet.
+    double values[Token::typeCount] = {};
+    bool isSet[Token::typeCount] = {};
+    std::string_view port;
+    bool hasPendingOptions = false;
+
+    auto emit = [&instructions](Instruction::Op op, uint32_t line) -> Instruction &
+    {
+        instructions.push_back({op, line, 0, 0, 0, 0});
+        return instructions.back();
+    };
+
+    auto move = [&](const Point &target, uint32_t line)
+    {
+        if (isPositionKnown && target == position)
+        {
+            // A move to where the pen already is only raises it.
+            if (pen != PenState::Up) emit(Instruction::Op::PenUp, line);
+            pen = PenState::Up;
+            return;
+        }
+
+        // Only the last of back-to-back moves matters.
+        Instruction &instruction = !instructions.empty() && instructions.back().op == Instruction::Op::Move
+                                   ? instructions.back() : emit(Instruction::Op::Move, line);
+        instruction.x = target.x;
+        instruction.y = target.y;
+
+        position = target;
+        isPositionKnown = true;
+        pen = PenState::Up;
+    };
+
+    for (const Instruction &instruction: program.instructions)
+    {
+        switch (instruction.op)
+        {
+            case Instruction::Op::InteractiveMode:
+            case Instruction::Op::PlotMode:
+            case Instruction::Op::SetPlot:
+            {
+                std::fill(std::begin(isSet), std::end(isSet), false);
+                hasPendingOptions = false;
+                pen = PenState::Unknown;
+                isPositionKnown = false;
+
+                instructions.push_back(instruction);
+                break;
+            }
+            case Instruction::Op::Connect:
+            case Instruction::Op::Disconnect:
+            case Instruction::Op::Sync:
+            case Instruction::Op::Plot:
+            {
+                if (instruction.op == Instruction::Op::Connect) hasPendingOptions = false;
+                pen = PenState::Unknown;
+                isPositionKnown = false;
+
+                instructions.push_back(instruction);
+                break;
+            }
+            case Instruction::Op::Options:
+            case Instruction::Op::UpdateOptions:
+            {
+                auto first = static_cast<uint32_t>(options.size());
+                for (uint32_t i = 0; i < instruction.count; i++)
+                {
+                    const Option &option = program.options[instruction.first + i];
+
+                    if (option.name == Token::Type::Port)
+                    {
+                        std::string_view value = program.text(option.first, option.count);
+                        if (isSet[option.name] && value == port) continue;
+                        port = value;
+                    } else
+                    {
+                        if (isSet[option.name] && values[option.name] == option.value) continue;
+                        values[option.name] = option.value;
+                    }
+
+                    // Coordinates after a change of units no longer compare with the ones before it.
+                    if (option.name == Token::Type::Units) isPositionKnown = false;
+
+                    isSet[option.name] = true;
+                    options.push_back(option);
+                }
+
+                auto count = static_cast<uint32_t>(options.size()) - first;
+                if (instruction.op == Instruction::Op::Options)
+                {
+                    if (count == 0) break;
+                    hasPendingOptions = true;
+                } else
+                {
+                    // UOPTS also sends the options set by earlier OPTS blocks, so it is only dropped if there are none.
+                    if (count == 0 && !hasPendingOptions) break;
+                    hasPendingOptions = false;
+                }
+
+                Instruction &block = emit(instruction.op, instruction.line);
+                block.first = first;
+                block.count = count;
+                break;
+            }
+            case Instruction::Op::PenUp:
+            {
+                if (pen != PenState::Up) emit(Instruction::Op::PenUp, instruction.line);
+                pen = PenState::Up;
+                break;
+            }
+            case Instruction::Op::PenDown:
+            {
+                if (pen != PenState::Down) emit(Instruction::Op::PenDown, instruction.line);
+                pen = PenState::Down;
+                break;
+            }
+            case Instruction::Op::PenToggle:
+            {
+                // A toggle with a known pen state is a plain PENUP or PENDOWN, which saves asking for the state.
+                if (pen == PenState::Unknown) instructions.push_back(instruction);
+                else
+                {
+                    emit(pen == PenState::Up ? Instruction::Op::PenDown : Instruction::Op::PenUp, instruction.line);
+                    pen = pen == PenState::Up ? PenState::Down : PenState::Up;
+                }
+                break;
+            }
+            case Instruction::Op::Move:
+                move({instruction.x, instruction.y}, instruction.line);
+                break;
+            case Instruction::Op::MoveRelative:
+            {
+                // Where it ends up depends on the clamping done by the plotter, so it is kept as it is.
+                instructions.push_back(instruction);
+                pen = PenState::Up;
+                isPositionKnown = false;
+                break;
+            }
+            case Instruction::Op::Draw:
+            {
+                auto first = static_cast<uint32_t>(points.size());
+                points.push_back(program.points[instruction.first]);
+
+                for (uint32_t i = 1; i < instruction.count; i++)
+                    if (program.points[instruction.first + i] != points.back())
+                        points.push_back(program.points[instruction.first + i]);
+
+                auto count = static_cast<uint32_t>(points.size()) - first;
+                if (count == 1)
+                {
+                    // A DRAW with a single distinct point is only a move to it.
+                    Point target = points.back();
+                    points.pop_back();
+
+                    move(target, instruction.line);
+                    break;
+                }
+
+                // A DRAW starts with a move to its first point, so a move right before it is never seen.
+                if (!instructions.empty() && instructions.back().op == Instruction::Op::Move) instructions.pop_back();
+
+                Instruction &draw = emit(Instruction::Op::Draw, instruction.line);
+                draw.first = first;
+                draw.count = count;
+
+                position = points.back();
+                isPositionKnown = true;
+                pen = PenState::Down;
+                break;
+            }
+            case Instruction::Op::Wait:
+            {
+                if (instruction.x <= 0) break;
+
+                if (!instructions.empty() && instructions.back().op == Instruction::Op::Wait)
+                    instructions.back().x += instruction.x;
+                else instructions.push_back(instruction);
+                break;
+            }
+            case Instruction::Op::GetPos:
+            case Instruction::Op::GetPen:
+                instructions.push_back(instruction);
+                break;
+        }
+    }
+
+    program.instructions = std::move(instructions);
+    program.points = std::move(points);
+    program.options = std::move(options);
+
+    Estimate after = Estimator().estimate(program.view());
+    Log(Log::Type::INFO, "Peephole optimizer removed " + std::to_string(commandsBefore - program.instructions.size()) +
+                         " of " + std::to_string(commandsBefore) + " commands and " +
+                         std::to_string(pointsBefore - program.points.size()) + " redundant points. Estimated "
+                         "time saved: " + formatDuration(before.seconds - after.seconds) + " (" +
+                         formatDuration(before.seconds) + " -> " + formatDuration(after.seconds) + ").");
+}
+
+#pragma endregion
@@ -1,708 +1,427 @@
 #include "include/parser.h"
 
-void Parser::checkInteractive(const std::string &functionName)
+#include <algorithm>
+
+static constexpr const char *optionNames = "ACCEL, PENU_POS, PEND_POS, PENU_DELAY, PEND_DELAY, PENU_SPEED, "
+                                           "PEND_SPEED, PENU_RATE, PEND_RATE, MODEL, PORT";
+
+static const char *optionDescription(Token::Type type)
 {
-    if (!isModeSet)
+    switch (type)
     {
-        Log(Log::Type::ERROR, "No mode specified. Please set a mode first.\nUsage: MODE <I|P>", fileState,
-            shouldExitOnError);
-        return;
-    }
-    if (axiDraw.getMode() != "interactive")
-    {
-        Log(Log::Type::ERROR, functionName + " can only be used in interactive mode.", fileState, shouldExitOnError);
-        return;
+        case Token::Type::Acceleration:
+            return "acceleration";
+        case Token::Type::PenUpPosition:
+            return "raised pen position";
+        case Token::Type::PenDownPosition:
+            return "lowered pen position";
+        case Token::Type::PenUpDelay:
+            return "pen raise delay";
+        case Token::Type::PenDownDelay:
+            return "pen lower delay";
+        case Token::Type::PenUpSpeed:
+            return "pen raise speed";
+        case Token::Type::PenDownSpeed:
+            return "pen lower speed";
+        case Token::Type::PenUpRate:
+            return "pen raise rate";
+        case Token::Type::PenDownRate:
+            return "pen lower rate";
+        default:
+            return "value";
     }
 }
 
-static std::string downloadFile(const std::string &url, int redirectLevel = 1)
+void Parser::error(const std::string &message)
 {
-    auto writeCallback = [](char *contents, size_t size, size_t nmemb, std::string *buffer)
-    {
-        size_t realSize = size * nmemb;
-        buffer->append(contents, realSize);
-
-        return realSize;
-    };
-
-    if (redirectLevel > MAX_REDIRECTS) Log(Log::Type::FATAL, "Too many redirects.");
-
-    Log(Log::Type::DEBUG, std::string(redirectLevel * 2, ' ') + "Downloading file from \"" + sanitize(url) + "\".");
-    Log(Log::Type::DEBUG, std::string(redirectLevel * 2, ' ') + "Resolving URL.");
-
-    CURL *curl = curl_easy_init();
-    if (!curl) Log(Log::Type::FATAL, "Could not initialize cURL.");
-
-    std::string userAgent = "AxiLang/" + std::string(PROJECT_VERSION);
-    std::string buffer;
-
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, MAX_REDIRECTS);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, userAgent.c_str());
+    Log(Log::Type::ERROR, message, fileState, shouldExitOnError);
 
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK) Log(Log::Type::FATAL, "Could not download file from \"" + sanitize(url) + "\".");
+    // Skip the rest of the arguments of the failed command so that they are not reported again.
+    while (index < fileState.tokens.size() && (fileState.tokens[index].type == Token::Type::Number ||
+                                               fileState.tokens[index].type == Token::Type::String))
+        index++;
+}
 
-    long responseCode;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode);
-    if (responseCode == 301 || responseCode == 302)
+bool Parser::checkInteractive(const std::string &functionName)
+{
+    if (!isModeSet)
     {
-        char *redirectUrl;
-        curl_easy_getinfo(curl, CURLINFO_REDIRECT_URL, &redirectUrl);
-
-        Log(Log::Type::DEBUG,
-            std::string(redirectLevel * 2, ' ') + "Redirecting to \"" + sanitize(redirectUrl) + "\".");
-        curl_easy_cleanup(curl);
-
-        return downloadFile(redirectUrl, redirectLevel + 1);
+        error("No mode specified. Please set a mode first.\nUsage: MODE <I|P>");
+        return false;
+    }
+    if (isModePlot)
+    {
+        error(functionName + " can only be used in interactive mode.");
+        return false;
     }
 
-    curl_easy_cleanup(curl);
-    Log(Log::Type::DEBUG, std::string(redirectLevel * 2, ' ') + "Creating temporary file.");
+    return true;
+}
+
+bool Parser::readNumber(double &value)
+{
+    if (index >= fileState.tokens.size() || fileState.tokens[index].type != Token::Type::Number) return false;
 
-    boost::filesystem::path temp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
-    std::ofstream file;
-    file.open(temp.string(), std::ios::out | std::ios::binary);
+    value = fileState.tokens[index++].number;
+    return true;
+}
 
-    if (!file.is_open())
-        Log(Log::Type::FATAL, std::string(redirectLevel * 2, ' ') + "Could not create temporary file for plot.");
+uint32_t Parser::currentLine()
+{
+    // Commands come in source order, so only the newlines since the previous one are counted. The source's line table
+    // is left for diagnostics to build.
+    uint32_t offset = fileState.tokens[fileState.cursor].offset;
+    std::string_view text = fileState.source->view();
 
-    file << buffer;
-    file.close();
+    lineNum += static_cast<uint32_t>(std::count(text.begin() + lineOffset, text.begin() + offset, '\n'));
+    lineOffset = offset;
 
-    Log(Log::Type::DEBUG, std::string(redirectLevel * 2, ' ') + "Saved to: " + temp.string());
-    return temp.string();
+    return lineNum;
 }
 
-void Parser::parse()
+Program Parser::parse(FileState newFileState)
 {
-    assert(Token::Type::EndOfFile == 36);
+    fileState = std::move(newFileState);
+    return parse();
+}
 
-    auto unknownToken = std::find_if(fileState.tokens.begin(), fileState.tokens.end(), [](const Token &token)
-    {
-        return token.type == Token::Type::Unknown;
-    });
+Program Parser::parse()
+{
+    Program program;
+    lineNum = 1;
+    lineOffset = 0;
 
-    if (unknownToken != fileState.tokens.end())
+    for (index = 0; index < fileState.tokens.size();)
     {
-        Log(Log::Type::ERROR, "Unknown token \"" + unknownToken->value + "\".", fileState, shouldExitOnError);
-        return;
-    }
+        fileState.cursor = index;
+        const Token &token = fileState.tokens[index++];
 
-    for (auto token: enumerate(fileState.tokens))
-    {
-        switch (token.item.type)
+        switch (token.type)
         {
             case Token::Type::Mode:
-            {
-                if (fileState.tokens.size() < token.index + 2)
-                {
-                    Log(Log::Type::ERROR, "No mode specified.\nUsage: MODE <I|P>", fileState,
-                        shouldExitOnError);
-                    break;
-                }
-
-                Token nextToken = fileState.tokens[token.index + 1];
-
-                switch (nextToken.type)
-                {
-                    case Token::Type::PlotMode:
-                        isModeSet = true;
-                        isModePlot = true;
-
-                        break;
-                    case Token::Type::InteractiveMode:
-                        axiDraw.modeInteractive();
-                        isModeSet = true;
-
-                        break;
-                    default:
-                        Log(Log::Type::ERROR, "Invalid mode specified.\nUsage: MODE <I|P>", fileState,
-                            shouldExitOnError);
-                        break;
-                }
+                parseMode(program);
                 break;
-            }
             case Token::Type::Opts:
             {
-                if (!isModeSet)
-                {
-                    Log(Log::Type::ERROR, "No mode specified. Please set a mode first.\nUsage: MODE <I|P>",
-                        fileState, shouldExitOnError);
-                    break;
-                }
-
-                if (fileState.tokens.size() < token.index + 3)
-                {
-                    Log(Log::Type::ERROR, "No option specified.\nUsage: OPTS\n\t<option> <value>\n\t...\nEND_OPTS",
-                        fileState, shouldExitOnError);
-                    break;
-                }
+                if (!isModeSet) error("No mode specified. Please set a mode first.\nUsage: MODE <I|P>");
+                else parseOptions(program, false);
 
-                Token optionName = fileState.tokens[token.index + 1];
-                Token optionValue = fileState.tokens[token.index + 2];
-
-                switch (optionName.type)
-                {
-                    case Token::Type::Acceleration:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setAcceleration(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid acceleration specified.\nUsage: ACCEL <VALUE>", fileState,
-                                shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenUpPosition:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenUpPosition(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid raised pen position specified.\nUsage: PENU_POS <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenDownPosition:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenDownPosition(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid lowered pen position specified.\nUsage: PEND_POS <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenUpDelay:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenUpDelay(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen raise delay specified.\nUsage: PENU_DELAY <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenDownDelay:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenDownDelay(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen lower delay specified.\nUsage: PEND_DELAY <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenUpSpeed:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenUpSpeed(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen raise speed specified.\nUsage: PENU_SPEED <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenDownSpeed:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenDownSpeed(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen lower speed specified.\nUsage: PEND_SPEED <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenUpRate:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenUpRate(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen raise rate specified.\nUsage: PENU_RATE <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenDownRate:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenDownRate(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen lower rate specified.\nUsage: PEND_RATE <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::Model:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setModel(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid model specified.\nUsage: MODEL <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::Port:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::String) axiDraw.setPort(next.value);
-                        else
-                            Log(Log::Type::ERROR, "Invalid port specified.\nUsage: PORT \"<VALUE>\"",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::Units:
-                        checkInteractive("UNITS");
-                        axiDraw.setUnits(std::stoi(optionValue.value));
-
-                        break;
-                    case Token::Type::EndOpts:
-                        break;
-                    default:
-                        Log(Log::Type::ERROR, std::string(
-                                    "Invalid option specified.\nUsage: OPTS <OPTIONS> <VALUE>\nOptions: ACCEL, PENU_POS, "
-                                    "PEND_POS, PENU_DELAY, PEND_DELAY, PENU_SPEED, PEND_SPEED, PENU_RATE, PEND_RATE, MODEL, "
-                                    "PORT") + (axiDraw.getMode() == "interactive" ? ", UNITS" : ""),
-                            fileState, shouldExitOnError);
-                        break;
-                }
                 break;
             }
             case Token::Type::UOpts:
             {
-                checkInteractive("UOPTS");
-
-                if (fileState.tokens.size() < token.index + 3)
-                {
-                    Log(Log::Type::ERROR, "No option specified.\nUsage: UOPTS\n\t<option> <value>\n\t...\nEND_UOPTS",
-                        fileState, shouldExitOnError);
-                    break;
-                }
-
-                Token optionName = fileState.tokens[token.index + 1];
-                Token optionValue = fileState.tokens[token.index + 2];
-
-                switch (optionName.type)
-                {
-                    case Token::Type::Acceleration:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setAcceleration(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid acceleration specified.\nUsage: ACCEL <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenUpPosition:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenUpPosition(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid raised pen position specified.\nUsage: PENU_POS <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenDownPosition:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenDownPosition(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid lowered pen position specified.\nUsage: PEND_POS <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenUpDelay:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenUpDelay(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen raise delay specified.\nUsage: PENU_DELAY <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenDownDelay:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenDownDelay(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen lower delay specified.\nUsage: PEND_DELAY <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenUpSpeed:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenUpSpeed(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen raise speed specified.\nUsage: PENU_SPEED <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenDownSpeed:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenDownSpeed(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen lower speed specified.\nUsage: PEND_SPEED <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenUpRate:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenUpRate(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen raise rate specified.\nUsage: PENU_RATE <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::PenDownRate:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setPenDownRate(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid pen lower rate specified.\nUsage: PEND_RATE <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::Model:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setModel(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid model specified.\nUsage: MODEL <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::Port:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::String) axiDraw.setPort(next.value);
-                        else
-                            Log(Log::Type::ERROR, "Invalid port specified.\nUsage: PORT \"<VALUE>\"",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::Units:
-                    {
-                        Token next = optionValue;
-                        if (next.type == Token::Type::Number) axiDraw.setUnits(std::stoi(next.value));
-                        else
-                            Log(Log::Type::ERROR, "Invalid units specified.\nUsage: UNITS <VALUE>",
-                                fileState, shouldExitOnError);
-
-                        break;
-                    }
-                    case Token::Type::EndUOpts:
-                        break;
-                    default:
-                        Log(Log::Type::ERROR, "Invalid option specified.\nUsage: UOPTS <OPTIONS> <VALUE>\n"
-                                              "Options: ACCEL, PENU_POS, PEND_POS, PENU_DELAY, PEND_DELAY, PENU_SPEED, "
-                                              "PEND_SPEED, PENU_RATE, PEND_RATE, MODEL, PORT, UNITS",
-                            fileState, shouldExitOnError);
-                        break;
-                }
-
-                axiDraw.updateOptions();
+                if (checkInteractive("UOPTS")) parseOptions(program, true);
                 break;
             }
             case Token::Type::Connect:
             {
-                checkInteractive("CONNECT");
-                axiDraw.connect();
-
+                if (checkInteractive("CONNECT")) program.add(Instruction::Op::Connect, currentLine());
                 break;
             }
             case Token::Type::Disconnect:
             {
-                checkInteractive("DISCONNECT");
-                axiDraw.disconnect();
-
+                if (checkInteractive("DISCONNECT")) program.add(Instruction::Op::Disconnect, currentLine());
                 break;
             }
             case Token::Type::PenUp:
             {
-                checkInteractive("PENUP");
-                axiDraw.penUp();
-
+                if (checkInteractive("PENUP")) program.add(Instruction::Op::PenUp, currentLine());
                 break;
             }
             case Token::Type::PenDown:
             {
-                checkInteractive("PENDOWN");
-                axiDraw.penDown();
-
+                if (checkInteractive("PENDOWN")) program.add(Instruction::Op::PenDown, currentLine());
                 break;
             }
             case Token::Type::PenToggle:
             {
-                checkInteractive("PENTOGGLE");
-                axiDraw.penToggle();
-
+                if (checkInteractive("PENTOGGLE")) program.add(Instruction::Op::PenToggle, currentLine());
                 break;
             }
             case Token::Type::Home:
             {
-                checkInteractive("HOME");
-                axiDraw.home();
+                if (!checkInteractive("HOME")) break;
 
+                program.add(Instruction::Op::Move, currentLine());
                 break;
             }
             case Token::Type::GoTo:
             {
-                checkInteractive("GOTO");
-
-                if (fileState.tokens.size() < token.index + 2)
-                {
-                    Log(Log::Type::ERROR, "Invalid coordinates specified.\nUsage: GOTO <X> <Y>", fileState,
-                        shouldExitOnError);
-                    break;
-                }
-
-                std::pair<double, double> point;
-                Token nextToken = fileState.tokens[token.index + 1];
-
-                if (nextToken.type == Token::Type::Number)
-                {
-                    point.first = std::stod(nextToken.value);
-                    nextToken = fileState.tokens[token.index + 1];
-                } else
-                {
-                    Log(Log::Type::ERROR, "Invalid X coordinate specified.\nUsage: GOTO <X> <Y>", fileState,
-                        shouldExitOnError);
-                    break;
-                }
-
-                if (nextToken.type == Token::Type::Number) point.second = std::stod(nextToken.value);
-                else
-                {
-                    Log(Log::Type::ERROR, "Invalid Y coordinate specified.\nUsage: GOTO <X> <Y>", fileState,
-                        shouldExitOnError);
-                    break;
-                }
-
-                axiDraw.goTo(point.first, point.second);
+                if (checkInteractive("GOTO")) parseMove(program, false);
                 break;
             }
             case Token::Type::GoToRelative:
             {
-                checkInteractive("GOTO_REL");
-
-                if (fileState.tokens.size() < token.index + 2)
-                {
-                    Log(Log::Type::ERROR, "Invalid coordinates specified.\nUsage: GOTO_REL <X> <Y>", fileState,
-                        shouldExitOnError);
-                    break;
-                }
-
-                std::pair<double, double> point;
-                Token nextToken = fileState.tokens[token.index + 1];
-
-                if (nextToken.type == Token::Type::Number)
-                {
-                    point.first = std::stod(nextToken.value);
-                    nextToken = fileState.tokens[token.index + 1];
-                } else
-                {
-                    Log(Log::Type::ERROR, "Invalid X coordinate specified.\nUsage: GOTO_REL <X> <Y>", fileState,
-                        shouldExitOnError);
-                    break;
-                }
-
-                if (nextToken.type == Token::Type::Number) point.second = std::stod(nextToken.value);
-                else
-                {
-                    Log(Log::Type::ERROR, "Invalid Y coordinate specified.\nUsage: GOTO_REL <X> <Y>", fileState,
-                        shouldExitOnError);
-                    break;
-                }
-
-                axiDraw.goToRelative(point.first, point.second);
+                if (checkInteractive("GOTO_REL")) parseMove(program, true);
                 break;
             }
             case Token::Type::Draw:
             {
-                checkInteractive("DRAW");
-
-                if (fileState.tokens.size() < token.index + 2)
-                {
-                    Log(Log::Type::ERROR, "Invalid coordinates specified.\nUsage: DRAW <X> <Y> <X> <Y> ...",
-                        fileState, shouldExitOnError);
-                    break;
-                }
-
-                std::vector<std::pair<double, double>> points;
-                size_t index = token.index + 1;
-
-                while (index < fileState.tokens.size())
-                {
-                    Token nextToken = fileState.tokens[index];
-                    if (nextToken.type == Token::Type::Number)
-                    {
-                        double x = std::stod(nextToken.value);
-                        index++;
-
-                        if (index < fileState.tokens.size())
-                        {
-                            nextToken = fileState.tokens[index];
-                            if (nextToken.type == Token::Type::Number)
-                            {
-                                double y = std::stod(nextToken.value);
-                                index++;
-
-                                points.emplace_back(x, y);
-                            } else
-                            {
-                                Log(Log::Type::ERROR,
-                                    "Invalid Y coordinate specified.\nUsage: DRAW <X> <Y> <X> <Y> ...",
-                                    fileState, shouldExitOnError);
-                                break;
-                            }
-                        } else
-                        {
-                            Log(Log::Type::ERROR,
-                                "Invalid number of coordinates specified.\nUsage: DRAW <X> <Y> <X> <Y> ...",
-                                fileState, shouldExitOnError);
-                            break;
-                        }
-                    } else
-                    {
-                        Log(Log::Type::ERROR, "Invalid X coordinate specified.\nUsage: DRAW <X> <Y> <X> <Y> ...",
-                            fileState, shouldExitOnError);
-                        break;
-                    }
-                }
-
-                axiDraw.draw(points);
+                if (checkInteractive("DRAW")) parseDraw(program);
                 break;
             }
             case Token::Type::Wait:
             {
-                checkInteractive("WAIT");
-
-                if (fileState.tokens.size() < token.index + 2)
-                {
-                    Log(Log::Type::ERROR, "Invalid wait time specified.\nUsage: WAIT <MS>", fileState,
-                        shouldExitOnError);
-                    break;
-                }
-
-                Token nextToken = fileState.tokens[token.index + 1];
-
-                if (nextToken.type == Token::Type::Number) axiDraw.wait(std::stod(nextToken.value));
-                else
-                {
-                    Log(Log::Type::ERROR, "Invalid wait time specified.\nUsage: WAIT <MS>", fileState,
-                        shouldExitOnError);
-                    break;
-                }
-
+                if (checkInteractive("WAIT")) parseWait(program);
                 break;
             }
             case Token::Type::GetPos:
             {
-                checkInteractive("GETPOS");
-                std::pair<double, double> pos = axiDraw.getPosition();
-
-                Log(Log::Type::INFO, "X: " + std::to_string(pos.first) + "Y: " + std::to_string(pos.second));
+                if (checkInteractive("GETPOS")) program.add(Instruction::Op::GetPos, currentLine());
                 break;
             }
             case Token::Type::GetPen:
             {
-                checkInteractive("GETPEN");
-
-                Log(Log::Type::INFO, std::string("Pen is ") + (axiDraw.getPen() ? "down" : "up") + ".");
+                if (checkInteractive("GETPEN")) program.add(Instruction::Op::GetPen, currentLine());
+                break;
+            }
+            case Token::Type::Sync:
+            {
+                if (checkInteractive("SYNC")) program.add(Instruction::Op::Sync, currentLine());
                 break;
             }
             case Token::Type::SetPlot:
             {
-                if (!isModePlot)
-                {
-                    Log(Log::Type::ERROR, "SETPLOT can only be used in plot mode.", fileState, shouldExitOnError);
-                    break;
-                }
-                if (fileState.tokens.size() < token.index + 2)
-                {
-                    Log(Log::Type::ERROR, "No file path/internet URL specified.", fileState, shouldExitOnError);
-                    break;
-                }
+                if (!isModePlot) error("SETPLOT can only be used in plot mode.");
+                else parseSetPlot(program);
 
-                std::string filePath = fileState.tokens[token.index + 1].value;
-                if (filePath.empty())
-                {
-                    Log(Log::Type::ERROR, "No file path/internet URL specified.", fileState, shouldExitOnError);
-                    break;
-                }
+                break;
+            }
+            case Token::Type::Plot:
+            {
+                if (!isModePlot) error("PLOT can only be used in plot mode.");
+                else if (!hasPlotFile) error("No plot specified. Please set one first.\nUsage: SETPLOT \"<PATH|URL>\"");
+                else program.add(Instruction::Op::Plot, currentLine());
+
+                break;
+            }
+            case Token::Type::Unknown:
+            {
+                error("Unknown token \"" + std::string(fileState.text(token)) + "\".");
+                break;
+            }
+            case Token::Type::EndOfFile:
+                return program;
+            default:
+            {
+                error("Unexpected token \"" + std::string(fileState.text(token)) + "\".");
+                break;
+            }
+        }
+    }
+
+    return program;
+}
+
+void Parser::parseMode(Program &program)
+{
+    if (index >= fileState.tokens.size())
+    {
+        error("No mode specified.\nUsage: MODE <I|P>");
+        return;
+    }
+
+    switch (fileState.tokens[index++].type)
+    {
+        case Token::Type::PlotMode:
+            isModeSet = true;
+            isModePlot = true;
+
+            program.add(Instruction::Op::PlotMode, currentLine());
+            break;
+        case Token::Type::InteractiveMode:
+            isModeSet = true;
+            isModePlot = false;
+
+            program.add(Instruction::Op::InteractiveMode, currentLine());
+            break;
+        default:
+            error("Invalid mode specified.\nUsage: MODE <I|P>");
+            break;
+    }
+}
 
-                if (std::regex_match(filePath, std::regex("https?://.*")))
-                    filePath = downloadFile(filePath);
+void Parser::parseOptions(Program &program, bool isUpdate)
+{
+    Token::Type endToken = isUpdate ? Token::Type::EndUOpts : Token::Type::EndOpts;
+    std::string usage = isUpdate ? "UOPTS\n\t<option> <value>\n\t...\nEND_UOPTS"
+                                 : "OPTS\n\t<option> <value>\n\t...\nEND_OPTS";
+
+    Instruction &instruction = program.add(isUpdate ? Instruction::Op::UpdateOptions : Instruction::Op::Options,
+                                           currentLine());
+    instruction.first = static_cast<uint32_t>(program.options.size());
+
+    while (index < fileState.tokens.size() && fileState.tokens[index].type != endToken)
+    {
+        fileState.cursor = index;
+        const Token &name = fileState.tokens[index++];
+        Option option = {name.type, 0, 0, 0};
 
-                std::ifstream file(filePath);
-                if (!file)
+        switch (name.type)
+        {
+            case Token::Type::Acceleration:
+            case Token::Type::PenUpPosition:
+            case Token::Type::PenDownPosition:
+            case Token::Type::PenUpDelay:
+            case Token::Type::PenDownDelay:
+            case Token::Type::PenUpSpeed:
+            case Token::Type::PenDownSpeed:
+            case Token::Type::PenUpRate:
+            case Token::Type::PenDownRate:
+            {
+                if (!readNumber(option.value))
                 {
-                    Log(Log::Type::ERROR, "Could not open file \"" + filePath + "\".", fileState, shouldExitOnError);
-                    break;
+                    error(std::string("Invalid ") + optionDescription(name.type) + " specified.\nUsage: " +
+                          Token::keywords[name.type].data() + " <VALUE>");
+                    continue;
                 }
-                file.close();
-
-                axiDraw.modePlot(filePath);
                 break;
             }
-            case Token::Type::Plot:
+            case Token::Type::Model:
             {
-                axiDraw.runPlot();
+                if (!readNumber(option.value) || option.value != static_cast<int>(option.value) ||
+                    option.value < 1 || option.value > 7)
+                {
+                    error("Invalid model specified.\nUsage: MODEL <VALUE>");
+                    continue;
+                }
                 break;
             }
-            case Token::Type::Unknown:
+            case Token::Type::Units:
             {
-                Log(Log::Type::ERROR, "Unknown token: " + token.item.value, fileState, shouldExitOnError);
+                if (isModePlot)
+                {
+                    error("UNITS can only be used in interactive mode.");
+                    continue;
+                }
+                if (!readNumber(option.value) || option.value != static_cast<int>(option.value) ||
+                    option.value < 0 || option.value > 2)
+                {
+                    error("Invalid units specified.\nUsage: UNITS <VALUE>");
+                    continue;
+                }
+
                 break;
             }
-            case Token::Type::PlotMode:
-            case Token::Type::InteractiveMode:
-            case Token::EndOpts:
-            case Token::EndUOpts:
-            case Token::Acceleration:
-            case Token::PenUpPosition:
-            case Token::PenDownPosition:
-            case Token::PenUpDelay:
-            case Token::PenDownDelay:
-            case Token::PenUpSpeed:
-            case Token::PenDownSpeed:
-            case Token::PenUpRate:
-            case Token::PenDownRate:
-            case Token::Model:
-            case Token::Port:
-            case Token::Units:
-            case Token::Number:
-            case Token::String:
-                break;
-            case Token::Type::EndOfFile:
+            case Token::Type::Port:
             {
-                return;
+                if (index >= fileState.tokens.size() || fileState.tokens[index].type != Token::Type::String)
+                {
+                    error("Invalid port specified.\nUsage: PORT \"<VALUE>\"");
+                    continue;
+                }
+
+                std::string_view port = fileState.text(fileState.tokens[index++]);
+                option.first = static_cast<uint32_t>(program.strings.size());
+                option.count = static_cast<uint32_t>(port.length());
+                program.strings += port;
+                break;
             }
             default:
             {
-                Log(Log::Type::ERROR, "Unexpected token: " + token.item.value, fileState, shouldExitOnError);
-                break;
+                error("Invalid option specified.\nUsage: " + usage + "\nOptions: " + optionNames +
+                      (isModePlot ? "" : ", UNITS"));
+                continue;
             }
         }
+
+        program.options.push_back(option);
+    }
+
+    if (index >= fileState.tokens.size())
+    {
+        error(std::string("Missing ") + Token::keywords[endToken].data() + ".\nUsage: " + usage);
+        return;
     }
+
+    index++;
+    Instruction &block = program.instructions.back();
+    block.count = static_cast<uint32_t>(program.options.size()) - block.first;
+}
+
+void Parser::parseMove(Program &program, bool isRelative)
+{
+    std::string usage = isRelative ? "GOTO_REL <X> <Y>" : "GOTO <X> <Y>";
+    Point point = {};
+
+    if (!readNumber(point.x))
+    {
+        error("Invalid X coordinate specified.\nUsage: " + usage);
+        return;
+    }
+    if (!readNumber(point.y))
+    {
+        error("Invalid Y coordinate specified.\nUsage: " + usage);
+        return;
+    }
+
+    // Relative moves are left to the plotter, which knows where the carriage really is after clamping and reconnecting.
+    Instruction &instruction = program.add(isRelative ? Instruction::Op::MoveRelative : Instruction::Op::Move,
+                                           currentLine());
+    instruction.x = point.x;
+    instruction.y = point.y;
+}
+
+void Parser::parseDraw(Program &program)
+{
+    size_t first = program.points.size();
+    Point point = {};
+
+    while (readNumber(point.x))
+    {
+        if (!readNumber(point.y))
+        {
+            program.points.resize(first);
+            error("Invalid number of coordinates specified.\nUsage: DRAW <X> <Y> <X> <Y> ...");
+            return;
+        }
+
+        program.points.push_back(point);
+    }
+
+    if (program.points.size() == first)
+    {
+        error("Invalid coordinates specified.\nUsage: DRAW <X> <Y> <X> <Y> ...");
+        return;
+    }
+
+    Instruction &instruction = program.add(Instruction::Op::Draw, currentLine());
+    instruction.first = static_cast<uint32_t>(first);
+    instruction.count = static_cast<uint32_t>(program.points.size() - first);
+}
+
+void Parser::parseWait(Program &program)
+{
+    double ms;
+    if (!readNumber(ms))
+    {
+        error("Invalid wait time specified.\nUsage: WAIT <MS>");
+        return;
+    }
+
+    program.add(Instruction::Op::Wait, currentLine()).x = ms;
+}
+
+void Parser::parseSetPlot(Program &program)
+{
+    if (index >= fileState.tokens.size() || fileState.tokens[index].type != Token::Type::String ||
+        fileState.tokens[index].length == 0)
+    {
+        error("No file path/internet URL specified.\nUsage: SETPLOT \"<PATH|URL>\"");
+        return;
+    }
+
+    std::string filePath(fileState.text(fileState.tokens[index++]));
+    if (!std::regex_match(filePath, std::regex("https?://.*")) && !boost::filesystem::is_regular_file(filePath))
+    {
+        error("Could not open file \"" + filePath + "\".");
+        return;
+    }
+
+    Instruction &instruction = program.add(Instruction::Op::SetPlot, currentLine());
+    instruction.first = static_cast<uint32_t>(program.strings.size());
+    instruction.count = static_cast<uint32_t>(filePath.length());
+
+    program.strings += filePath;
+    hasPlotFile = true;
 }
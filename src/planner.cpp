@@ -0,0 +1,78 @@
+#include "include/planner.h"
+
+#include <algorithm>
+
+// How far, in inches, the carriage may cut a corner in the junction deviation model. It is not an actual deviation:
+// the carriage still goes through every vertex, only at the speed of a round corner of this size.
+static constexpr double JUNCTION_DEVIATION = 0.002;
+
+double PlannedMove::distanceAt(double t) const
+{
+    double rampUp = accelerationTime(), cruise = cruiseTime();
+    if (t <= 0) return 0;
+    if (t < rampUp) return entrySpeed * t + acceleration * t * t / 2;
+
+    double distance = (entrySpeed + cruiseSpeed) * rampUp / 2;
+    if (t < rampUp + cruise) return distance + cruiseSpeed * (t - rampUp);
+
+    double braking = std::min(t - rampUp - cruise, decelerationTime());
+    return std::min(distance + cruiseSpeed * cruise + cruiseSpeed * braking - acceleration * braking * braking / 2,
+                    length);
+}
+
+MotionPlanner::MotionPlanner(MotionLimits limits) : limits(limits) {}
+
+double MotionPlanner::junctionSpeed(const PlannedMove &from, const PlannedMove &to) const
+{
+    // Cosine of the angle between the reversed incoming direction and the outgoing one: -1 going straight on, 1 when
+    // turning back.
+    double cosine = -((from.end.x - from.start.x) * (to.end.x - to.start.x) +
+                      (from.end.y - from.start.y) * (to.end.y - to.start.y)) / (from.length * to.length);
+
+    if (cosine > 0.999999) return 0;
+    if (cosine < -0.999999) return limits.speed;
+
+    double sinHalf = std::sqrt((1 - cosine) / 2);
+    return std::min(std::sqrt(limits.acceleration * JUNCTION_DEVIATION * sinHalf / (1 - sinHalf)), limits.speed);
+}
+
+const std::vector<PlannedMove> &MotionPlanner::plan(const Point *points, size_t count)
+{
+    moves.clear();
+    for (size_t i = 1; i < count; i++)
+    {
+        double length = distance(moves.empty() ? points[0] : moves.back().end, points[i]);
+        if (length > 0)
+            moves.push_back({moves.empty() ? points[0] : moves.back().end, points[i], length, 0, 0, 0,
+                             limits.acceleration});
+    }
+    if (moves.empty()) return moves;
+
+    // Entry speeds start at what each corner allows; then a backward pass makes sure the carriage can always stop in
+    // time for the slower corners ahead, and a forward pass that it can actually speed up to each entry speed.
+    for (size_t i = 1; i < moves.size(); i++) moves[i].entrySpeed = junctionSpeed(moves[i - 1], moves[i]);
+
+    for (size_t i = moves.size(); i-- > 0;)
+    {
+        double exitSpeed = i + 1 < moves.size() ? moves[i + 1].entrySpeed : 0;
+        moves[i].exitSpeed = exitSpeed;
+        moves[i].entrySpeed = std::min(moves[i].entrySpeed, std::sqrt(exitSpeed * exitSpeed +
+                                                                      2 * limits.acceleration * moves[i].length));
+    }
+
+    for (size_t i = 0; i < moves.size(); i++)
+    {
+        PlannedMove &move = moves[i];
+        if (i > 0) move.entrySpeed = std::min(move.entrySpeed, moves[i - 1].exitSpeed);
+
+        move.exitSpeed = std::min(move.exitSpeed, std::sqrt(move.entrySpeed * move.entrySpeed +
+                                                            2 * limits.acceleration * move.length));
+
+        // Highest speed reachable by speeding up from the entry speed and slowing down to the exit speed in time.
+        double peak = std::sqrt((2 * limits.acceleration * move.length + move.entrySpeed * move.entrySpeed +
+                                 move.exitSpeed * move.exitSpeed) / 2);
+        move.cruiseSpeed = std::max(std::min(peak, limits.speed), std::max(move.entrySpeed, move.exitSpeed));
+    }
+
+    return moves;
+}
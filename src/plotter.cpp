@@ -0,0 +1,19 @@
+#include "include/plotter.h"
+
+#include <algorithm>
+
+#include "include/api.h"
+#include "include/ebb.h"
+#include "include/mock.h"
+
+bool Plotter::isBackend(const std::string &name)
+{
+    return std::find(std::begin(BACKENDS), std::end(BACKENDS), name) != std::end(BACKENDS);
+}
+
+std::unique_ptr<Plotter> Plotter::create(const std::string &name)
+{
+    if (name == "ebb") return std::make_unique<EbbPlotter>();
+    if (name == "null" || name == "mock") return std::make_unique<MockPlotter>(name == "mock");
+    return std::make_unique<AxiDraw>();
+}
@@ -0,0 +1,281 @@
+#include "include/preview.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include <zlib.h>
+
+// Side of a tile, in pixels.
+static constexpr size_t TILE_SIZE = 256;
+// Line width of the pen (0.4 mm) and of pen-up travel, which is always one pixel wide.
+static constexpr double PEN_WIDTH = 0.4 / 25.4;
+static constexpr float TRAVEL_WIDTH = 1;
+static constexpr float TRAVEL_OPACITY = 0.6f;
+
+static constexpr uint8_t PAPER_COLOR[3] = {255, 255, 255};
+static constexpr uint8_t INK_COLOR[3] = {16, 16, 48};
+static constexpr uint8_t TRAVEL_COLOR[3] = {230, 60, 60};
+
+#pragma region PNG
+
+static void writeChunk(std::ofstream &file, const char *type, const std::string &data)
+{
+    auto writeUint32 = [&file](uint32_t value)
+    {
+        char bytes[4] = {static_cast<char>(value >> 24), static_cast<char>(value >> 16), static_cast<char>(value >> 8),
+                         static_cast<char>(value)};
+        file.write(bytes, 4);
+    };
+
+    uLong crc = crc32(0, reinterpret_cast<const Bytef *>(type), 4);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(data.data()), static_cast<uInt>(data.size()));
+
+    writeUint32(static_cast<uint32_t>(data.size()));
+    file.write(type, 4);
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    writeUint32(static_cast<uint32_t>(crc));
+}
+
+// Writes 8-bit RGB pixels, row by row, as a PNG file without row filters.
+static bool writePng(const std::string &path, size_t width, size_t height, const std::vector<uint8_t> &pixels)
+{
+    std::string rows;
+    rows.reserve((width * 3 + 1) * height);
+    for (size_t y = 0; y < height; y++)
+    {
+        rows.push_back('\0');
+        rows.append(reinterpret_cast<const char *>(pixels.data()) + y * width * 3, width * 3);
+    }
+
+    uLongf compressedSize = compressBound(rows.size());
+    std::string compressed(compressedSize, '\0');
+    if (compress2(reinterpret_cast<Bytef *>(compressed.data()), &compressedSize,
+                  reinterpret_cast<const Bytef *>(rows.data()), rows.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+        return false;
+    compressed.resize(compressedSize);
+
+    std::string header(13, '\0');
+    for (int i = 0; i < 4; i++)
+    {
+        header[i] = static_cast<char>(width >> (24 - 8 * i));
+        header[4 + i] = static_cast<char>(height >> (24 - 8 * i));
+    }
+    header[8] = 8; // Bit depth
+    header[9] = 2; // RGB
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write("\x89PNG\r\n\x1a\n", 8);
+    writeChunk(file, "IHDR", header);
+    writeChunk(file, "IDAT", compressed);
+    writeChunk(file, "IEND", "");
+    file.close();
+
+    return static_cast<bool>(file);
+}
+
+#pragma endregion
+
+Preview::Preview(double dpi, bool showsTravel, unsigned threads)
+        : dpi(dpi), showsTravel(showsTravel), threads(threads), width(0), height(0) {}
+
+void Preview::collect(const ProgramView &program)
+{
+    // Same bookkeeping as the estimator: coordinates follow the active UNITS and are limited to the MODEL envelope.
+    int units = 0;
+    size_t model = 1, largestModel = 1;
+    Point position = {0, 0};
+
+    auto moveTo = [&](const Point &target, bool isTravel)
+    {
+        const ModelSpec &spec = MODEL_SPECS[model];
+        Point end = {std::clamp(target.x / UNITS_PER_INCH[units], 0.0, spec.width),
+                     std::clamp(target.y / UNITS_PER_INCH[units], 0.0, spec.height)};
+
+        if (!isTravel || showsTravel)
+            segments.push_back({static_cast<float>(position.x), static_cast<float>(position.y),
+                                static_cast<float>(end.x), static_cast<float>(end.y), isTravel});
+        position = end;
+    };
+
+    for (size_t index = 0; index < program.instructionCount; index++)
+    {
+        const Instruction &instruction = program.instructions[index];
+
+        switch (instruction.op)
+        {
+            case Instruction::Op::Options:
+            case Instruction::Op::UpdateOptions:
+            {
+                for (uint32_t i = 0; i < instruction.count; i++)
+                {
+                    const Option &option = program.options[instruction.first + i];
+                    if (option.name == Token::Type::Units) units = std::clamp(static_cast<int>(option.value), 0, 2);
+                    else if (option.name == Token::Type::Model)
+                    {
+                        model = std::clamp(static_cast<size_t>(option.value), size_t(1), MODEL_COUNT - 1);
+                        if (MODEL_SPECS[model].width * MODEL_SPECS[model].height >
+                            MODEL_SPECS[largestModel].width * MODEL_SPECS[largestModel].height)
+                            largestModel = model;
+                    }
+                }
+                break;
+            }
+            case Instruction::Op::Connect:
+                position = {0, 0};
+                break;
+            case Instruction::Op::Move:
+                moveTo({instruction.x, instruction.y}, true);
+                break;
+            case Instruction::Op::MoveRelative:
+                moveTo({position.x * UNITS_PER_INCH[units] + instruction.x,
+                        position.y * UNITS_PER_INCH[units] + instruction.y}, true);
+                break;
+            case Instruction::Op::Draw:
+            {
+                moveTo(program.points[instruction.first], true);
+                for (uint32_t i = 1; i < instruction.count; i++) moveTo(program.points[instruction.first + i], false);
+
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    width = static_cast<size_t>(std::ceil(MODEL_SPECS[largestModel].width * dpi));
+    height = static_cast<size_t>(std::ceil(MODEL_SPECS[largestModel].height * dpi));
+
+    for (Segment &segment: segments)
+    {
+        segment.x0 = static_cast<float>(segment.x0 * dpi);
+        segment.y0 = static_cast<float>(segment.y0 * dpi);
+        segment.x1 = static_cast<float>(segment.x1 * dpi);
+        segment.y1 = static_cast<float>(segment.y1 * dpi);
+    }
+}
+
+void Preview::renderTile(size_t column, size_t row, const uint32_t *indices, size_t count,
+                         std::vector<uint8_t> &image) const
+{
+    size_t left = column * TILE_SIZE, top = row * TILE_SIZE;
+    size_t tileWidth = std::min(TILE_SIZE, width - left), tileHeight = std::min(TILE_SIZE, height - top);
+
+    // Coverage of each pixel by ink and by travel. Overlapping strokes take the maximum instead of adding up, so that
+    // the joints of a path are not darker than the rest of it.
+    std::vector<float> ink(tileWidth * tileHeight, 0), travel(showsTravel ? tileWidth * tileHeight : 0, 0);
+    float penWidth = static_cast<float>(PEN_WIDTH * dpi);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const Segment &segment = segments[indices[i]];
+
+        // Lines thinner than a pixel are drawn one pixel wide, but fainter.
+        float lineWidth = segment.isTravel ? TRAVEL_WIDTH : penWidth;
+        float reach = std::max(lineWidth, 1.0f) / 2 + 0.5f;
+        float strength = std::min(lineWidth, 1.0f);
+        std::vector<float> &coverage = segment.isTravel ? travel : ink;
+
+        float dx = segment.x1 - segment.x0, dy = segment.y1 - segment.y0, lengthSquared = dx * dx + dy * dy;
+        float minX = std::max(std::min(segment.x0, segment.x1) - reach - static_cast<float>(left), 0.0f);
+        float minY = std::max(std::min(segment.y0, segment.y1) - reach - static_cast<float>(top), 0.0f);
+        float maxX = std::min(std::max(segment.x0, segment.x1) + reach - static_cast<float>(left),
+                              static_cast<float>(tileWidth));
+        float maxY = std::min(std::max(segment.y0, segment.y1) + reach - static_cast<float>(top),
+                              static_cast<float>(tileHeight));
+
+        float segmentTop = std::min(segment.y0, segment.y1), segmentBottom = std::max(segment.y0, segment.y1);
+        for (auto y = static_cast<size_t>(minY); static_cast<float>(y) < maxY; y++)
+        {
+            // Only the part of the row around where the segment crosses it can be covered, which matters for long
+            // diagonal travel moves.
+            float rowMinX = minX, rowMaxX = maxX;
+            if (dy != 0)
+            {
+                float center = static_cast<float>(top + y) + 0.5f;
+                float y0 = std::clamp(center - reach, segmentTop, segmentBottom);
+                float y1 = std::clamp(center + reach, segmentTop, segmentBottom);
+                float x0 = segment.x0 + (y0 - segment.y0) * dx / dy - static_cast<float>(left);
+                float x1 = segment.x0 + (y1 - segment.y0) * dx / dy - static_cast<float>(left);
+
+                rowMinX = std::max(minX, std::min(x0, x1) - reach);
+                rowMaxX = std::min(maxX, std::max(x0, x1) + reach);
+            }
+
+            for (auto x = static_cast<size_t>(std::max(rowMinX, 0.0f)); static_cast<float>(x) < rowMaxX; x++)
+            {
+                float px = static_cast<float>(left + x) + 0.5f - segment.x0;
+                float py = static_cast<float>(top + y) + 0.5f - segment.y0;
+                float t = lengthSquared > 0 ? std::clamp((px * dx + py * dy) / lengthSquared, 0.0f, 1.0f) : 0;
+                float ex = px - t * dx, ey = py - t * dy, distanceSquared = ex * ex + ey * ey;
+                if (distanceSquared >= reach * reach) continue;
+
+                float &pixel = coverage[y * tileWidth + x];
+                pixel = std::max(pixel, std::min(reach - std::sqrt(distanceSquared), 1.0f) * strength);
+            }
+        }
+    }
+
+    for (size_t y = 0; y < tileHeight; y++)
+    {
+        uint8_t *out = image.data() + ((top + y) * width + left) * 3;
+        for (size_t x = 0; x < tileWidth; x++, out += 3)
+        {
+            float up = showsTravel ? travel[y * tileWidth + x] * TRAVEL_OPACITY : 0, down = ink[y * tileWidth + x];
+            for (int channel = 0; channel < 3; channel++)
+            {
+                float value = PAPER_COLOR[channel] + (TRAVEL_COLOR[channel] - PAPER_COLOR[channel]) * up;
+                value += (INK_COLOR[channel] - value) * down;
+                out[channel] = static_cast<uint8_t>(value + 0.5f);
+            }
+        }
+    }
+}
+
+void Preview::render(const ProgramView &program, const std::string &path)
+{
+    segments.clear();
+    collect(program);
+
+    size_t columns = (width + TILE_SIZE - 1) / TILE_SIZE, rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+    float reach = static_cast<float>(std::max(PEN_WIDTH * dpi, 1.0)) / 2 + 1;
+
+    auto forEachTile = [&](const Segment &segment, auto &&fn)
+    {
+        auto toTile = [](float value, size_t limit)
+        {
+            return std::min(static_cast<size_t>(std::max(value, 0.0f)) / TILE_SIZE, limit - 1);
+        };
+
+        size_t firstColumn = toTile(std::min(segment.x0, segment.x1) - reach, columns);
+        size_t lastColumn = toTile(std::max(segment.x0, segment.x1) + reach, columns);
+        size_t firstRow = toTile(std::min(segment.y0, segment.y1) - reach, rows);
+        size_t lastRow = toTile(std::max(segment.y0, segment.y1) + reach, rows);
+
+        for (size_t row = firstRow; row <= lastRow; row++)
+            for (size_t column = firstColumn; column <= lastColumn; column++) fn(row * columns + column);
+    };
+
+    // Bins the segments by tile with a counting sort: count, turn the counts into offsets, then fill.
+    std::vector<size_t> offsets(columns * rows + 1, 0);
+    for (const Segment &segment: segments) forEachTile(segment, [&](size_t tile) { offsets[tile + 1]++; });
+    for (size_t tile = 0; tile < columns * rows; tile++) offsets[tile + 1] += offsets[tile];
+
+    std::vector<uint32_t> binned(offsets.back());
+    std::vector<size_t> filled(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < segments.size(); i++)
+        forEachTile(segments[i], [&](size_t tile) { binned[filled[tile]++] = static_cast<uint32_t>(i); });
+
+    std::vector<uint8_t> image(width * height * 3);
+    parallelFor(columns * rows, threads, [&](size_t tile)
+    {
+        renderTile(tile % columns, tile / columns, binned.data() + offsets[tile], offsets[tile + 1] - offsets[tile],
+                   image);
+    });
+
+    if (!writePng(path, width, height, image))
+        Log(Log::Type::FATAL, "Could not write preview to \"" + path + "\".");
+
+    Log(Log::Type::INFO, "Saved a " + std::to_string(width) + "x" + std::to_string(height) + " preview of " +
+                         std::to_string(segments.size()) + " segments to \"" + path + "\".");
+}
@@ -0,0 +1,190 @@
+#include "include/scanner.h"
+
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#    define AXILANG_X86_KERNELS
+#    include <immintrin.h>
+#endif
+
+#pragma region Scalar
+
+static inline bool isWhitespace(char c)
+{
+    return c == ' ' || static_cast<unsigned char>(c - '\t') < 5;
+}
+
+static uint64_t whitespaceMaskScalar(const char *data, size_t length)
+{
+    uint64_t mask = 0;
+    for (size_t i = 0; i < length; i++) mask |= static_cast<uint64_t>(isWhitespace(data[i])) << i;
+
+    return mask;
+}
+
+static size_t findBlockCommentEndScalar(const char *data, size_t begin, size_t end)
+{
+    for (; begin + 1 < end; begin++) if (data[begin] == '=' && data[begin + 1] == '%') return begin;
+    return end;
+}
+
+#pragma endregion
+#ifdef AXILANG_X86_KERNELS
+#pragma region SSE2
+
+// Whitespace is ' ' or one of '\t', '\n', '\v', '\f', '\r' (9 - 13). The range check is done as an unsigned
+// "c - 9 <= 4", using min_epu8 since SSE2 has no unsigned byte comparison.
+static inline uint64_t whitespaceMask16(const char *data)
+{
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+    __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+    __m128i space = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+
+    return static_cast<uint16_t>(_mm_movemask_epi8(_mm_or_si128(control, space)));
+}
+
+static uint64_t whitespaceMaskSSE2(const char *data, size_t length)
+{
+    if (length < 64) return whitespaceMaskScalar(data, length);
+
+    return whitespaceMask16(data) | whitespaceMask16(data + 16) << 16 | whitespaceMask16(data + 32) << 32 |
+           whitespaceMask16(data + 48) << 48;
+}
+
+static size_t findBlockCommentEndSSE2(const char *data, size_t begin, size_t end)
+{
+    for (; begin + 17 <= end; begin += 16)
+    {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + begin));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + begin + 1));
+
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, _mm_set1_epi8('=')),
+                                                   _mm_cmpeq_epi8(second, _mm_set1_epi8('%'))));
+        if (mask) return begin + __builtin_ctz(mask);
+    }
+
+    return findBlockCommentEndScalar(data, begin, end);
+}
+
+#pragma endregion
+#pragma region AVX2
+
+__attribute__((target("avx2"))) static inline uint64_t whitespaceMask32(const char *data)
+{
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    __m256i shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+    __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+    __m256i space = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '));
+
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(control, space)));
+}
+
+__attribute__((target("avx2"))) static uint64_t whitespaceMaskAVX2(const char *data, size_t length)
+{
+    if (length < 64) return whitespaceMaskScalar(data, length);
+    return whitespaceMask32(data) | whitespaceMask32(data + 32) << 32;
+}
+
+__attribute__((target("avx2"))) static size_t findBlockCommentEndAVX2(const char *data, size_t begin, size_t end)
+{
+    for (; begin + 33 <= end; begin += 32)
+    {
+        __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + begin));
+        __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + begin + 1));
+
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(first, _mm256_set1_epi8('=')),
+                                 _mm256_cmpeq_epi8(second, _mm256_set1_epi8('%')))));
+        if (mask) return begin + __builtin_ctz(mask);
+    }
+
+    return findBlockCommentEndSSE2(data, begin, end);
+}
+
+#pragma endregion
+#endif
+#pragma region Dispatch
+
+struct ScannerKernels
+{
+    const char *instructionSet;
+
+    uint64_t (*whitespaceMask)(const char *, size_t);
+    size_t (*findBlockCommentEnd)(const char *, size_t, size_t);
+};
+
+static ScannerKernels selectKernels()
+{
+#ifdef AXILANG_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {"AVX2", whitespaceMaskAVX2, findBlockCommentEndAVX2};
+
+    return {"SSE2", whitespaceMaskSSE2, findBlockCommentEndSSE2};
+#else
+    return {"scalar", whitespaceMaskScalar, findBlockCommentEndScalar};
+#endif
+}
+
+static const ScannerKernels kernels = selectKernels();
+
+#pragma endregion
+
+Scanner::Scanner(const char *data, size_t size) : data(data), size(size), blockStart(0), blockMask(0)
+{
+    if (size > 0) loadBlock(0);
+}
+
+void Scanner::loadBlock(size_t pos)
+{
+    blockStart = pos & ~static_cast<size_t>(63);
+    blockMask = kernels.whitespaceMask(data + blockStart, std::min<size_t>(size - blockStart, 64));
+}
+
+size_t Scanner::skipWhitespace(size_t pos)
+{
+    while (pos < size)
+    {
+        if (pos < blockStart || pos - blockStart >= 64) loadBlock(pos);
+
+        // Bits past the end of a partial block are clear, so they read as "not whitespace"; the result is clamped.
+        uint64_t words = ~blockMask >> (pos - blockStart);
+        if (words) return std::min(pos + __builtin_ctzll(words), size);
+
+        pos = blockStart + 64;
+    }
+
+    return size;
+}
+
+size_t Scanner::findWhitespace(size_t pos)
+{
+    while (pos < size)
+    {
+        if (pos < blockStart || pos - blockStart >= 64) loadBlock(pos);
+
+        uint64_t spaces = blockMask >> (pos - blockStart);
+        if (spaces) return pos + __builtin_ctzll(spaces);
+
+        pos = blockStart + 64;
+    }
+
+    return size;
+}
+
+size_t Scanner::findLineEnd(size_t pos) const
+{
+    // memchr is already vectorized by every libc we build against.
+    const void *found = pos < size ? memchr(data + pos, '\n', size - pos) : nullptr;
+    return found ? static_cast<const char *>(found) - data : size;
+}
+
+size_t Scanner::findBlockCommentEnd(size_t pos) const
+{
+    return kernels.findBlockCommentEnd(data, pos, size);
+}
+
+const char *Scanner::getInstructionSet()
+{
+    return kernels.instructionSet;
+}
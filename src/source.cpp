@@ -0,0 +1,73 @@
+#include "include/source.h"
+
+#include <algorithm>
+#include <cstring>
+
+uint64_t hashBytes(const char *data, size_t size, uint64_t hash)
+{
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+
+        hash = (hash ^ word) * 0x100000001b3;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++) hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001b3;
+
+    return hash;
+}
+
+std::shared_ptr<const Source> Source::fromFile(const std::string &path)
+{
+    std::shared_ptr<Source> source(new Source());
+
+    source->mapping.open(path);
+    source->text = std::string_view(source->mapping.data(), source->mapping.size());
+
+    return source;
+}
+
+std::shared_ptr<const Source> Source::fromString(std::string str)
+{
+    std::shared_ptr<Source> source(new Source());
+
+    source->buffer = std::move(str);
+    source->text = source->buffer;
+
+    return source;
+}
+
+std::string_view Source::view() const
+{
+    return text;
+}
+
+size_t Source::size() const
+{
+    return text.size();
+}
+
+uint64_t Source::hash() const
+{
+    return hashBytes(text.data(), text.size());
+}
+
+SourceLocation Source::locate(uint32_t offset) const
+{
+    std::call_once(lineStartsBuilt, [this]
+    {
+        lineStarts.push_back(0);
+        for (const char *c = text.data(); (c = static_cast<const char *>(
+                memchr(c, '\n', text.data() + text.size() - c))) != nullptr; c++)
+            lineStarts.push_back(static_cast<uint32_t>(c - text.data() + 1));
+    });
+
+    size_t line = std::upper_bound(lineStarts.begin(), lineStarts.end(), offset) - lineStarts.begin() - 1;
+    size_t lineEnd = line + 1 < lineStarts.size() ? lineStarts[line + 1] - 1 : text.size();
+    if (lineEnd > lineStarts[line] && text[lineEnd - 1] == '\r') lineEnd--;
+
+    return {static_cast<int>(line + 1), static_cast<int>(offset - lineStarts[line]),
+            text.substr(lineStarts[line], lineEnd - lineStarts[line])};
+}
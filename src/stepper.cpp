@@ -0,0 +1,91 @@
+#include "include/stepper.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+StepCompiler::StepCompiler() : stepX(0), stepY(0), carryX(0), carryY(0), carryMs(0) {}
+
+void StepCompiler::reset()
+{
+    stepX = stepY = 0;
+    carryX = carryY = carryMs = 0;
+}
+
+Point StepCompiler::getPosition() const
+{
+    return {(static_cast<double>(stepX) + carryX) / STEPS_PER_INCH,
+            (static_cast<double>(stepY) + carryY) / STEPS_PER_INCH};
+}
+
+int64_t StepCompiler::emit(int64_t x, int64_t y, int64_t ms, std::vector<StepPacket> &packets)
+{
+    // The AxiDraw is a CoreXY machine: the two motors turn by the sum and the difference of the X and Y steps.
+    // Rounding a short slice down must not ask them for more than MAX_STEP_RATE; the time added for that is taken
+    // back from the packets after it.
+    int64_t motor1 = x + y, motor2 = x - y;
+    ms = std::max(ms, (std::max(std::abs(motor1), std::abs(motor2)) * 1000 + MAX_STEP_RATE - 1) / MAX_STEP_RATE);
+
+    packets.push_back({static_cast<uint32_t>(ms), static_cast<int32_t>(motor1), static_cast<int32_t>(motor2)});
+    stepX += x;
+    stepY += y;
+    return ms;
+}
+
+void StepCompiler::advance(double dx, double dy, double seconds, std::vector<StepPacket> &packets)
+{
+    carryX += dx * STEPS_PER_INCH;
+    carryY += dy * STEPS_PER_INCH;
+    carryMs += seconds * 1000;
+
+    auto x = static_cast<int64_t>(std::llround(carryX)), y = static_cast<int64_t>(std::llround(carryY));
+    auto ms = static_cast<int64_t>(std::llround(carryMs));
+    if ((x == 0 && y == 0) || ms <= 0) return;
+
+    carryX -= static_cast<double>(x);
+    carryY -= static_cast<double>(y);
+    carryMs -= static_cast<double>(emit(x, y, ms, packets));
+}
+
+void StepCompiler::compile(const std::vector<PlannedMove> &moves, std::vector<StepPacket> &packets)
+{
+    for (const PlannedMove &move: moves)
+    {
+        double directionX = (move.end.x - move.start.x) / move.length;
+        double directionY = (move.end.y - move.start.y) / move.length;
+        double rampUp = move.accelerationTime(), cruise = move.cruiseTime(), rampDown = move.decelerationTime();
+        double time = 0, covered = 0;
+
+        auto sampleTo = [&](double until)
+        {
+            double distance = move.distanceAt(until);
+            advance(directionX * (distance - covered), directionY * (distance - covered), until - time, packets);
+
+            time = until;
+            covered = distance;
+        };
+        auto sampleRamp = [&](double from, double length)
+        {
+            auto slices = static_cast<size_t>(std::ceil(length * 1000 / SLICE_MS));
+            for (size_t i = 1; i <= slices; i++)
+                sampleTo(from + length * static_cast<double>(i) / static_cast<double>(slices));
+        };
+
+        sampleRamp(0, rampUp);
+        if (cruise > 0) sampleTo(rampUp + cruise);
+        sampleRamp(rampUp + cruise, rampDown);
+
+        // Whatever distanceAt() left over from floating point error still belongs to this move.
+        advance(directionX * (move.length - covered), directionY * (move.length - covered), 0, packets);
+    }
+
+    // A path ends at rest, so steps still waiting for a millisecond to go with them are sent now.
+    auto x = static_cast<int64_t>(std::llround(carryX)), y = static_cast<int64_t>(std::llround(carryY));
+    if (x != 0 || y != 0)
+    {
+        carryX -= static_cast<double>(x);
+        carryY -= static_cast<double>(y);
+        emit(x, y, std::max(static_cast<int64_t>(std::llround(carryMs)), int64_t(1)), packets);
+    }
+    carryMs = 0;
+}